@@ -10,7 +10,12 @@
                 "src/anyxml2var_builder_wrapper.cpp",
                 "src/anyxml2var_builder_wrapper.h",
                 "src/v8_var_policy.cpp",
-                "src/v8_var_policy.h"
+                "src/v8_var_policy.h",
+                "src/feed_async_worker.h",
+                "src/parallel_parse_worker.h",
+                "src/time_slice.h",
+                "src/columns.cpp",
+                "src/columns.h"
             ],
             "include_dirs": [
                 "deps/include",
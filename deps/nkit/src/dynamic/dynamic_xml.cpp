@@ -86,20 +86,35 @@ namespace nkit
     return DynamicFromAnyXml(xml, options, root_name, error);
   }
 
+  // Mapping is parsed as the only one with empty name
+  static Dynamic parse_xml(const std::string & xml,
+      const detail::Options::Ptr & options, const Dynamic & mapping,
+      std::string * const error)
+  {
+    Dynamic mappings = Dynamic::Dict();
+    mappings[S_EMPTY_] = mapping;
+    Xml2VarPlan::Ptr plan = Xml2VarPlan::Create(options, mappings, error);
+    if (!plan)
+      return Dynamic();
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder =
+        StructXml2VarBuilder<DynamicBuilder>::Create(plan);
+    if (!builder->Feed(xml.c_str(), xml.length(), true, error))
+      return Dynamic();
+    return builder->var(S_EMPTY_);
+  }
+
   Dynamic DynamicFromXml(const std::string & xml,
       const std::string & options,
       const std::string & mapping,
       std::string * const error)
   {
-    StructXml2VarBuilder<DynamicBuilder>::Ptr builder = StructXml2VarBuilder<
-        DynamicBuilder>::Create(options, error);
-    if(!builder)
+    detail::Options::Ptr o = detail::Options::Create(options, error);
+    if (!o)
       return Dynamic();
-    if (!builder->AddMapping(S_EMPTY_, mapping, error))
+    Dynamic m = DynamicFromJson(mapping, error);
+    if (!m)
       return Dynamic();
-    if (!builder->Feed(xml.c_str(), xml.length(), true, error))
-      return Dynamic();
-    return builder->var(S_EMPTY_);
+    return parse_xml(xml, o, m, error);
   }
 
   Dynamic DynamicFromXml(const std::string & xml,
@@ -121,15 +136,10 @@ namespace nkit
       const Dynamic & mapping,
       std::string * const error)
   {
-    StructXml2VarBuilder<DynamicBuilder>::Ptr builder = StructXml2VarBuilder<
-        DynamicBuilder>::Create(options, error);
-    if(!builder)
+    detail::Options::Ptr o = detail::Options::Create(options, error);
+    if (!o)
       return Dynamic();
-    if (!builder->AddMapping(S_EMPTY_, mapping, error))
-      return Dynamic();
-    if (!builder->Feed(xml.c_str(), xml.length(), true, error))
-      return Dynamic();
-    return builder->var(S_EMPTY_);
+    return parse_xml(xml, o, mapping, error);
   }
 
   Dynamic DynamicFromXmlFile(const std::string & path,
@@ -5,7 +5,7 @@
 
 #include <cstdlib>
 #include <string>
-#include <map>
+#include <vector>
 
 #include "nkit/constants.h"
 #include "nkit/tools.h"
@@ -13,27 +13,40 @@
 namespace nkit
 {
   //---------------------------------------------------------------------------
+  // Element name <-> id map. Names are kept in open addressing hash table
+  // (linear probing, at most half full) with precomputed hashes, ids are
+  // indexes in dense vector of names.
+  // Names, passed by Expat, are not cached by their addresses: Expat keeps
+  // tag names in buffers, which are reused for other tags, so the same
+  // pointer may point to different names during parsing.
   class String2IdMap
   {
   public:
     static const size_t STAR_ID = 0;
+    // '//' (descendant axis) in mask paths
+    static const size_t DESCENDANT_ID = 1;
+
+    static const size_t UNKNOWN_ID = static_cast<size_t>(-1);
 
   private:
-    struct CompareStrings
+    static const size_t EMPTY_SLOT = UNKNOWN_ID;
+    static const size_t INITIAL_CAPACITY = 64;
+
+    struct Slot
     {
-      bool operator ()(const char * s1, const char * s2) const
-      {
-        return strcmp(s1, s2) < 0;
-      }
+      Slot() : hash_(0), id_(EMPTY_SLOT) {}
+
+      uint32_t hash_;
+      size_t id_;
     };
 
-    typedef std::map<char *, size_t, CompareStrings> Name2Id;
+    typedef std::vector<char *> Id2Name;
+    typedef std::vector<Slot> Slots;
 
   public:
     String2IdMap()
-      : max_element_id_(1)
     {
-      name2id_[NKIT_STRDUP(S_STAR_.c_str())] = STAR_ID;
+      Init();
     }
 
     String2IdMap(const String2IdMap & from)
@@ -49,66 +62,125 @@ namespace nkit
     String2IdMap & operator =(const String2IdMap & from)
     {
       if (this != &from)
+      {
+        Clear();
         Set(from);
+      }
 
       return *this;
     }
 
     size_t GetId(const char * str)
     {
-      Name2Id::const_iterator it = name2id_.find(const_cast<char *>(str)), end =
-          name2id_.end();
-      if (it != end)
-        return it->second;
-      size_t element_id = max_element_id_++;
-      name2id_.insert(std::make_pair(NKIT_STRDUP(str), element_id));
+      uint32_t hash = Hash(str);
+      size_t i = FindSlot(str, hash);
+      if (slots_[i].id_ != EMPTY_SLOT)
+        return slots_[i].id_;
+
+      size_t element_id = id2name_.size();
+      id2name_.push_back(NKIT_STRDUP(str));
+      slots_[i].hash_ = hash;
+      slots_[i].id_ = element_id;
+      if (id2name_.size() * 2 > slots_.size())
+        Rehash(slots_.size() * 2);
       return element_id;
     }
 
+    // Returns UNKNOWN_ID if 'str' has no id. Does not change the map, so
+    // it is safe to call it from several threads
+    size_t FindId(const char * str) const
+    {
+      return slots_[FindSlot(str, Hash(str))].id_;
+    }
+
+    size_t size() const { return id2name_.size(); }
+
     std::string GetString(size_t id) const
     {
-      Name2Id::const_iterator it = name2id_.begin(), end = name2id_.end();
-      for (; it != end; ++it)
-        if (it->second == id)
-          return std::string(it->first);
+      if (id < id2name_.size())
+        return std::string(id2name_[id]);
       return std::string("");
     }
 
     std::ostream & operator >> (std::ostream & str) const
     {
-      Name2Id::const_iterator it = name2id_.begin(), end = name2id_.end();
-      for (; it != end; ++it)
+      for (size_t id = 0; id < id2name_.size(); ++id)
       {
-          str << std::string(it->first) << std::string(": ") <<
-        		  string_cast(it->second) << '\n';
+          str << std::string(id2name_[id]) << std::string(": ") <<
+        		  string_cast(id) << '\n';
       }
       return str;
     }
 
   private:
-    void Clear()
+    // FNV-1a
+    static uint32_t Hash(const char * str)
     {
-      max_element_id_ = 1;
+      uint32_t hash = 2166136261u;
+      for (; *str; ++str)
+        hash = (hash ^ static_cast<uint8_t>(*str)) * 16777619u;
+      return hash;
+    }
 
-      Name2Id::const_iterator it = name2id_.begin(), end = name2id_.end();
+    // Returns slot with 'str' or empty slot for it
+    size_t FindSlot(const char * str, uint32_t hash) const
+    {
+      size_t mask = slots_.size() - 1;
+      size_t i = hash & mask;
+      for (; slots_[i].id_ != EMPTY_SLOT; i = (i + 1) & mask)
+      {
+        if (slots_[i].hash_ == hash && strcmp(id2name_[slots_[i].id_], str) == 0)
+          break;
+      }
+      return i;
+    }
+
+    void Init()
+    {
+      slots_.assign(INITIAL_CAPACITY, Slot());
+      GetId(S_STAR_.c_str()); // STAR_ID
+      GetId("//"); // DESCENDANT_ID, element names never contain '/'
+    }
+
+    void Rehash(size_t capacity)
+    {
+      Slots slots(capacity);
+      size_t mask = capacity - 1;
+      Slots::const_iterator it = slots_.begin(), end = slots_.end();
+      for (; it != end; ++it)
+      {
+        if (it->id_ == EMPTY_SLOT)
+          continue;
+        size_t i = it->hash_ & mask;
+        while (slots[i].id_ != EMPTY_SLOT)
+          i = (i + 1) & mask;
+        slots[i] = *it;
+      }
+      slots_.swap(slots);
+    }
+
+    void Clear()
+    {
+      Id2Name::const_iterator it = id2name_.begin(), end = id2name_.end();
       for (; it != end; ++it)
-        free(it->first);
+        free(*it);
+      id2name_.clear();
+      slots_.clear();
     }
 
     void Set(const String2IdMap & from)
     {
-      Clear();
-      max_element_id_ = from.max_element_id_;
-
-      Name2Id::const_iterator it = from.name2id_.begin(), end =
-          from.name2id_.end();
+      slots_ = from.slots_;
+      id2name_.reserve(from.id2name_.size());
+      Id2Name::const_iterator it = from.id2name_.begin(), end =
+          from.id2name_.end();
       for (; it != end; ++it)
-        name2id_.insert(std::make_pair(NKIT_STRDUP(it->first), it->second));
+        id2name_.push_back(NKIT_STRDUP(*it));
     }
 
   private:
-    Name2Id name2id_;
-    size_t max_element_id_;
+    Id2Name id2name_;
+    Slots slots_;
   };
 
   inline std::ostream & operator << (std::ostream & str, const String2IdMap & map)
@@ -0,0 +1,156 @@
+#ifndef NKIT_VX_TEXT_SLICE_H
+#define NKIT_VX_TEXT_SLICE_H
+
+#include <cstddef>
+#include <string>
+
+namespace nkit
+{
+  //---------------------------------------------------------------------------
+  // Set of white space characters as lookup table: trimming costs one table
+  // load per character instead of strchr() over the set.
+  class WhiteSpaceTable
+  {
+  public:
+    explicit WhiteSpaceTable(const std::string & white_spaces)
+    {
+      Assign(white_spaces);
+    }
+
+    void Assign(const std::string & white_spaces)
+    {
+      for (size_t i = 0; i < 256; ++i)
+        table_[i] = false;
+      for (size_t i = 0; i < white_spaces.size(); ++i)
+        table_[static_cast<unsigned char>(white_spaces[i])] = true;
+    }
+
+    bool operator()(char ch) const
+    {
+      return table_[static_cast<unsigned char>(ch)];
+    }
+
+    // Moves 'begin' and 'end' to the first and after the last non white
+    // space characters
+    void Trim(const char ** begin, const char ** end) const
+    {
+      const char * b = *begin, * e = *end;
+      while (b != e && table_[static_cast<unsigned char>(*b)])
+        ++b;
+      while (e != b && table_[static_cast<unsigned char>(*(e - 1))])
+        --e;
+      *begin = b;
+      *end = e;
+    }
+
+  private:
+    bool table_[256];
+  };
+
+  //---------------------------------------------------------------------------
+  // Text of element, which may be passed by Expat in several callbacks.
+  // While text arrives in one callback and points into Expat buffer, only
+  // pointer to it is kept. Otherwise (text is split, or Expat passes it
+  // from temporary storage: entity references, new lines, converted
+  // encodings) it is copied to own buffer, which keeps its capacity
+  // between elements.
+  // Expat buffer is moved by the next Feed(), so Detach() must be called
+  // for all unfinished texts after parsing of every chunk.
+  class TextSlice
+  {
+  public:
+    TextSlice()
+      : data_("")
+      , size_(0)
+      , own_(false)
+    {}
+
+    TextSlice(const TextSlice & other)
+      : data_("")
+      , size_(0)
+      , own_(false)
+    {
+      Append(other.data_, other.size_, false);
+    }
+
+    TextSlice & operator = (const TextSlice & other)
+    {
+      if (this != &other)
+      {
+        Clear();
+        Append(other.data_, other.size_, false);
+      }
+      return *this;
+    }
+
+    // 'in_buffer': text is in Expat buffer and stays valid until the end
+    // of parsing of current chunk
+    void Append(const char * text, size_t len, bool in_buffer)
+    {
+      if (len == 0)
+        return;
+
+      if (size_ == 0 && in_buffer)
+      {
+        data_ = text;
+        size_ = len;
+        return;
+      }
+
+      if (!own_)
+      {
+        buffer_.assign(data_, size_);
+        own_ = true;
+      }
+      else if (data_ != buffer_.data() || size_ != buffer_.size())
+      {
+        // buffer was trimmed
+        buffer_.erase(0, static_cast<size_t>(data_ - buffer_.data()));
+        buffer_.resize(size_);
+      }
+      buffer_.append(text, len);
+      data_ = buffer_.data();
+      size_ = buffer_.size();
+    }
+
+    void Detach()
+    {
+      if (size_ != 0 && !own_)
+      {
+        buffer_.assign(data_, size_);
+        data_ = buffer_.data();
+        own_ = true;
+      }
+    }
+
+    void Trim(const WhiteSpaceTable & white_spaces)
+    {
+      const char * end = data_ + size_;
+      white_spaces.Trim(&data_, &end);
+      size_ = static_cast<size_t>(end - data_);
+    }
+
+    // Capacity of own buffer is kept
+    void Clear()
+    {
+      data_ = "";
+      size_ = 0;
+      own_ = false;
+      buffer_.clear();
+    }
+
+    const char * data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    std::string str() const { return std::string(data_, size_); }
+
+  private:
+    const char * data_;
+    size_t size_;
+    bool own_;
+    std::string buffer_;
+  };
+
+} // namespace nkit
+
+#endif // NKIT_VX_TEXT_SLICE_H
@@ -33,15 +33,16 @@ namespace nkit
       object_ = nkit::Dynamic(value);
     }
 
-    void InitAsInteger( std::string const & value )
+    void InitAsInteger( const char * value, size_t size )
     {
-      int64_t i = !value.empty() ? NKIT_STRTOLL(value.c_str(), NULL, 10) : 0;
+      int64_t i = 0;
+      parse_int64(value, size, &i);
       object_ = nkit::Dynamic(i);
     }
 
-    void InitAsString( std::string const & value)
+    void InitAsString( const char * value, size_t size )
     {
-      object_ = nkit::Dynamic(value);
+      object_ = nkit::Dynamic(value, size);
     }
 
     void InitAsUndefined()
@@ -49,6 +50,13 @@ namespace nkit
       object_ = nkit::Dynamic();
     }
 
+    void InitAsFloat( const char * value, size_t size )
+    {
+      double d(0.0);
+      parse_double(value, size, &d);
+      object_ = nkit::Dynamic(d);
+    }
+
     void InitAsFloatFormat( std::string const & value, const char * format )
     {
       double d(0.0);
@@ -91,10 +99,10 @@ namespace nkit
       object_.PushBack(obj);
     }
 
-    void AppendToDictKeyList( std::string const & key, type const & var )
+    void AppendToDictKeyList( const DictKey & key, type const & var )
     {
       Dynamic * list_value;
-      if (object_.Get(key, &list_value))
+      if (object_.Get(key.name(), &list_value))
       {
         if (!list_value->IsList())
           *list_value = DLIST(*list_value);
@@ -109,11 +117,27 @@ namespace nkit
       }
     }
 
-    void SetDictKeyValue( std::string const & key, type const & var )
+    void SetDictKeyValue( const DictKey & key, type const & var )
     {
-      object_[std::string(key)] = var;
+      object_[key.name()] = var;
     }
 
+    void SetDictKeyValue( const DictKey & key,
+        const DynamicBuilderPolicy & var )
+    {
+      SetDictKeyValue(key, var.object_);
+    }
+
+    void AppendToDictKeyList( const DictKey & key,
+        const DynamicBuilderPolicy & var )
+    {
+      AppendToDictKeyList(key, var.object_);
+    }
+
+    // Dynamic values need no special storage
+    void UseLocalHandles(bool) {}
+    void Persist() {}
+
     type const & get() const
     {
       return object_;
@@ -1,6 +1,10 @@
 #ifndef VX_EXPAT_PARSER_H
 #define VX_EXPAT_PARSER_H
 
+#include <cstring>
+#include <string>
+#include <vector>
+
 #include "nkit/tools.h"
 #include "expat.h"
 
@@ -9,20 +13,172 @@
 namespace nkit
 {
   //----------------------------------------------------------------------------
+  // Returns local part of element or attribute name, passed by ExpatParser
+  // in namespaces mode ("{uri}local" -> "local")
+  inline const char * local_name(const char * name)
+  {
+    if (*name != '{')
+      return name;
+    const char * end = strchr(name, '}');
+    return end ? end + 1 : name;
+  }
+
+  //----------------------------------------------------------------------------
+  // With 'namespaces' Expat resolves prefixes, and names of elements and
+  // attributes with namespace are passed to handlers as "{uri}local"
+  // (names without namespace are passed as is); xmlns attributes are not
+  // passed.
   template<typename T>
   class ExpatParser
   {
   public:
-    ExpatParser() :
-        parser_(XML_ParserCreate(NULL))
+    explicit ExpatParser(bool namespaces = false) :
+        parser_(NewParser(namespaces))
+      , namespaces_(namespaces)
+      , skip_depth_(0)
+      , finished_(false)
+      , last_(false)
+      , suspend_interval_(0)
+      , elements_before_suspend_(0)
     {
       Reset();
     }
 
     bool Feed(const char* chunk, size_t len, bool last, std::string * error)
     {
+      // After Finish() the rest of document is ignored
+      if (finished_)
+      {
+        if (last)
+          Reset();
+        return true;
+      }
+
+      last_ = last;
+      return OnParsed(XML_Parse(parser_, chunk, len, last), error);
+    }
+
+    // Must be called from handler: Feed() (or Resume()) returns as soon
+    // as handler returns, the rest of chunk is kept by Expat until Resume()
+    void Suspend()
+    {
+      XML_StopParser(parser_, XML_TRUE);
+    }
+
+    bool suspended() const
+    {
+      XML_ParsingStatus status;
+      XML_GetParsingStatus(parser_, &status);
+      return status.parsing == XML_SUSPENDED;
+    }
+
+    // Continues parsing of chunk after Suspend()
+    bool Resume(std::string * error)
+    {
+      return OnParsed(XML_ResumeParser(parser_), error);
+    }
+
+    // Parser suspends itself after each 'elements' start tags (0 - never),
+    // so caller can check time budget between Feed() and Resume() calls
+    // without splitting chunk
+    void SetSuspendInterval(size_t elements)
+    {
+      suspend_interval_ = elements;
+      elements_before_suspend_ = elements;
+    }
+
+    // Drops state of current document: next Feed() starts new one
+    void Restart()
+    {
+      Reset();
+    }
+
+    // Parser is created anew, if mode is changed (state of current document
+    // is dropped in this case)
+    void UseNamespaces(bool namespaces)
+    {
+      if (namespaces == namespaces_)
+        return;
+      XML_ParserFree(parser_);
+      parser_ = NewParser(namespaces);
+      namespaces_ = namespaces;
+      Reset();
+    }
+
+    // Parser has got all needed data and ignores the rest of document
+    // (until Feed() with 'last' flag or Restart())
+    bool finished() const
+    {
+      return finished_;
+    }
+
+  protected:
+    // dtor is non-virtual because it is protected and will not be
+    // used explicitly
+    ~ExpatParser()
+    {
+      XML_ParserFree(parser_);
+    }
+
+    void Reset()
+    {
+      finished_ = false;
+      XML_ParserReset(parser_, NULL);
+      XML_SetUserData(parser_, this);
+      SetHandlers();
+      XML_SetUnknownEncodingHandler(parser_, &ExpatParser::OnUnknownEncoding,
+          this);
+    }
+
+    // Text, passed to OnText(), points into Expat buffer (not to temporary
+    // storage of entity references, new lines or converted encodings), so
+    // it stays valid until Feed() (or Resume()) returns. Derived class
+    // must copy such texts in OnChunkParsed(), if it still needs them.
+    bool InBuffer(const char * text) const
+    {
+      int offset = 0, size = 0;
+      const char * buffer = XML_GetInputContext(parser_, &offset, &size);
+      return buffer != NULL && text >= buffer && text < buffer + size;
+    }
+
+    // Must be called from OnStartElement(): the rest of current element
+    // (its children and text) is skipped, Expat only counts depth with
+    // minimal handlers until the element is closed. OnEndElement() is not
+    // called for skipped element.
+    void SkipSubtree()
+    {
+      skip_depth_ = 1;
+      XML_SetElementHandler(parser_, &ExpatParser::OnSkippedStartElement,
+          &ExpatParser::OnSkippedEndElement);
+      XML_SetCharacterDataHandler(parser_, NULL);
+    }
+
+    // Must be called from handler: stops parsing without error
+    void Finish()
+    {
+      finished_ = true;
+      XML_StopParser(parser_, XML_FALSE);
+    }
+
+  private:
+    // Expat joins URI and local name with separator: "uri}local", so only
+    // '{' is prepended to get "{uri}local"
+    static const char NAMESPACE_SEPARATOR = '}';
+
+    static XML_Parser NewParser(bool namespaces)
+    {
+      if (namespaces)
+        return XML_ParserCreateNS(NULL, NAMESPACE_SEPARATOR);
+      return XML_ParserCreate(NULL);
+    }
+
+    bool OnParsed(XML_Status status, std::string * error)
+    {
+      static_cast<T*>(this)->OnChunkParsed();
+
       bool result = true;
-      if (!XML_Parse(parser_, chunk, len, last))
+      // Finish() is called from handler, so Expat returns error in this case
+      if (status == XML_STATUS_ERROR && !finished_)
       {
         XML_Error code = XML_GetErrorCode(parser_);
         if (code == XML_ERROR_ABORTED)
@@ -39,39 +195,69 @@ namespace nkit
         result = false;
       }
 
-      if (last)
+      if (last_ && status != XML_STATUS_SUSPENDED)
         Reset();
       return result;
     }
 
-  protected:
-    // dtor is non-virtual because it is protected and will not be
-    // used explicitly
-    ~ExpatParser()
+    void SetHandlers()
     {
-      XML_ParserFree(parser_);
+      skip_depth_ = 0;
+      if (namespaces_)
+        XML_SetElementHandler(parser_, &ExpatParser::OnStartElementNS,
+            &ExpatParser::OnEndElementNS);
+      else
+        XML_SetElementHandler(parser_, &ExpatParser::OnStartElement,
+            &ExpatParser::OnEndElement);
+      XML_SetCharacterDataHandler(parser_, &ExpatParser::OnText);
     }
 
-    void Reset()
+    // Converts "uri}local" to "{uri}local" in 'buffer'
+    static const char * ClarkName(const char * name, std::string * buffer)
     {
-      XML_ParserReset(parser_, NULL);
-      XML_SetUserData(parser_, this);
-      XML_SetElementHandler(parser_, &ExpatParser::OnStartElement,
-          &ExpatParser::OnEndElement);
-      XML_SetCharacterDataHandler(parser_, &ExpatParser::OnText);
-      XML_SetUnknownEncodingHandler(parser_, &ExpatParser::OnUnknownEncoding,
-          this);
+      if (strchr(name, NAMESPACE_SEPARATOR) == NULL)
+        return name;
+      buffer->assign(1, '{');
+      buffer->append(name);
+      return buffer->c_str();
+    }
+
+    // Attributes are copied only if some of them have namespace
+    const char ** ClarkAttributes(const char ** attrs)
+    {
+      size_t count = 0, qualified = 0;
+      for (; attrs[count]; count += 2)
+        if (strchr(attrs[count], NAMESPACE_SEPARATOR) != NULL)
+          ++qualified;
+      if (qualified == 0)
+        return attrs;
+
+      if (attribute_names_.size() < count / 2)
+        attribute_names_.resize(count / 2);
+      attributes_.assign(attrs, attrs + count + 1);
+      for (size_t i = 0; i < count; i += 2)
+        attributes_[i] = ClarkName(attrs[i], &attribute_names_[i / 2]);
+      return &attributes_[0];
     }
 
-  private:
     void AbortParsing()
     {
       XML_StopParser(parser_, 0);
     }
 
+    void CountElement()
+    {
+      if (unlikely(suspend_interval_ && --elements_before_suspend_ == 0))
+      {
+        elements_before_suspend_ = suspend_interval_;
+        Suspend();
+      }
+    }
+
     static void OnStartElement(void *data, const char *el, const char **attr)
     {
       T * derived = static_cast<T *>(data);
+      derived->CountElement();
       if (!derived->OnStartElement(el, attr))
         derived->AbortParsing();
     }
@@ -83,6 +269,20 @@ namespace nkit
         derived->AbortParsing();
     }
 
+    static void OnStartElementNS(void *data, const char *el,
+        const char **attr)
+    {
+      ExpatParser * parser = static_cast<ExpatParser *>(data);
+      OnStartElement(data, ClarkName(el, &parser->element_name_),
+          parser->ClarkAttributes(attr));
+    }
+
+    static void OnEndElementNS(void *data, const char *el)
+    {
+      ExpatParser * parser = static_cast<ExpatParser *>(data);
+      OnEndElement(data, ClarkName(el, &parser->element_name_));
+    }
+
     static void OnText(void *data, const char *txt, int len)
     {
       T * derived = static_cast<T *>(data);
@@ -90,6 +290,21 @@ namespace nkit
         derived->AbortParsing();
     }
 
+    static void OnSkippedStartElement(void *data,
+        const char * NKIT_UNUSED(el), const char ** NKIT_UNUSED(attr))
+    {
+      ExpatParser * parser = static_cast<ExpatParser *>(data);
+      parser->CountElement();
+      ++parser->skip_depth_;
+    }
+
+    static void OnSkippedEndElement(void *data, const char * NKIT_UNUSED(el))
+    {
+      ExpatParser * parser = static_cast<ExpatParser *>(data);
+      if (--parser->skip_depth_ == 0)
+        parser->SetHandlers();
+    }
+
     static int OnUnknownEncoding(void * NKIT_UNUSED(data),
         const XML_Char * name,
         XML_Encoding * info)
@@ -113,6 +328,17 @@ namespace nkit
 
   private:
     XML_Parser parser_;
+    bool namespaces_;
+    // buffers for names in "{uri}local" form
+    std::string element_name_;
+    std::vector<std::string> attribute_names_;
+    std::vector<const char *> attributes_;
+    size_t skip_depth_;
+    bool finished_;
+    // 'last' flag of chunk, which is being parsed
+    bool last_;
+    size_t suspend_interval_;
+    size_t elements_before_suspend_;
   };
 
 } // namespace nkit
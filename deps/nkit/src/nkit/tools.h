@@ -114,6 +114,13 @@ namespace nkit
 #endif
   std::string string_cast(double v, size_t precision = 2);
 
+  //----------------------------------------------------------------------------
+  // Locale independent parsing of decimal numbers. Like strtoll() and
+  // strtod(), skip leading white spaces and stop at first unexpected
+  // character. Return false (and don't touch *out) if there are no digits.
+  bool parse_int64(const char * str, size_t size, int64_t * out);
+  bool parse_double(const char * str, size_t size, double * out);
+
   //----------------------------------------------------------------------------
   inline uint64_t & operator << (uint64_t & uv, const std::string & s)
   {
@@ -1,9 +1,13 @@
 #ifndef NKIT_XML2VAR_H
 #define NKIT_XML2VAR_H
 
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include <stack>
 
 #include "nkit/detail/str2id.h"
+#include "nkit/detail/text_slice.h"
 #include "nkit/dynamic_json.h"
 #include "nkit/dynamic_getter.h"
 #include "nkit/expat_parser.h"
@@ -12,6 +16,41 @@
 
 namespace nkit
 {
+  //----------------------------------------------------------------------------
+  // Key of object for builder policies. Keys, which are known before
+  // parsing (keys of mappings, "attrkey" and "textkey"), get process-wide
+  // ids once, when mappings are compiled, so policies may keep data for
+  // them in arrays by id; keys, taken from data, have NO_ID.
+  // DictKey does not copy the name: the string must outlive the key, so
+  // keep keys only for the duration of one builder call (a temporary name
+  // lives till the end of the full expression with the call).
+  class DictKey
+  {
+  public:
+    static const size_t NO_ID = static_cast<size_t>(-1);
+
+    DictKey(const std::string & name)
+      : name_(&name)
+      , id_(NO_ID)
+    {}
+
+    DictKey(const std::string & name, size_t id)
+      : name_(&name)
+      , id_(id)
+    {}
+
+    // Thread safe; the same name always gets the same id
+    static size_t Register(const std::string & name);
+
+    const std::string & name() const { return *name_; }
+    size_t id() const { return id_; }
+    bool empty() const { return name_->empty(); }
+
+  private:
+    const std::string * name_;
+    size_t id_;
+  };
+
   namespace detail
   {
     struct Options
@@ -20,6 +59,7 @@ namespace nkit
       static const bool UNICODE_DEFAULT;
       static const bool ORDERED_DICT;
       static const bool EXPLICIT_ARRAY_DEFAULT;
+      static const bool INT64_DEFAULT;
 
       typedef NKIT_SHARED_PTR(Options) Ptr;
 
@@ -55,9 +95,12 @@ namespace nkit
           .Get(".textkey", &ret->textkey_, S_EMPTY_)
           .Get(".ordered_dict", &ret->ordered_dict_, ORDERED_DICT)
           .Get(".explicit_array", &ret->explicit_array_, EXPLICIT_ARRAY_DEFAULT)
+          .Get(".int64", &ret->int64_, INT64_DEFAULT)
           .Get(".true_variants", &ret->true_variants_, EMPTY_STRING_SET_)
           .Get(".false_variants", &ret->false_variants_, EMPTY_STRING_SET_)
         ;
+        ret->white_space_table_.Assign(ret->white_spaces_);
+        ret->RegisterKeys();
 
         if (!config.ok())
         {
@@ -68,28 +111,118 @@ namespace nkit
         ret->use_custom_bool_variants_ = !ret->false_variants_.empty() ||
                 !ret->false_variants_.empty();
 
+        const Dynamic * emit_depth = NULL;
+        if (config.data().IsDict()
+            && config.data().Get("emit_depth", &emit_depth))
+        {
+          if (!emit_depth->IsNumber() || emit_depth->GetFloat() < 1.0)
+          {
+            *error = "Option 'emit_depth' must be positive number";
+            return Ptr();
+          }
+          ret->emit_depth_ = static_cast<size_t>(emit_depth->GetFloat());
+        }
+
+        const Dynamic * namespaces = NULL;
+        if (config.data().IsDict()
+            && config.data().Get("namespaces", &namespaces))
+        {
+          if (namespaces->IsBool())
+            ret->namespaces_ = namespaces->GetBoolean();
+          else if (namespaces->IsString()
+              && namespaces->GetConstString() == "strip")
+            ret->namespaces_ = ret->strip_namespaces_ = true;
+          else
+          {
+            *error = "Option 'namespaces' must be boolean or \"strip\"";
+            return Ptr();
+          }
+        }
+
+        const Dynamic * limit = NULL;
+        if (config.data().IsDict() && config.data().Get("limit", &limit))
+        {
+          if (!limit->IsDict())
+          {
+            *error = "Option 'limit' must be dictionary (object)";
+            return Ptr();
+          }
+
+          ret->stop_when_completed_ = true;
+          DDICT_FOREACH(pair, *limit)
+          {
+            if (!pair->second.IsNumber() || pair->second.GetFloat() < 1.0)
+            {
+              *error = "Limit of '" + pair->first +
+                  "' mapping must be positive number";
+              return Ptr();
+            }
+            // conversion of too big number to size_t is undefined
+            double limit_value = pair->second.GetFloat();
+            ret->limits_[pair->first] = limit_value < 1e18 ?
+                static_cast<size_t>(limit_value) : 0;
+          }
+        }
+
         return ret;
       }
 
       Options()
         : trim_(TRIM_DEFAULT)
         , white_spaces_(WHITE_SPACES)
+        , white_space_table_(WHITE_SPACES)
         , unicode_(UNICODE_DEFAULT)
         , ordered_dict_(ORDERED_DICT)
         , explicit_array_(EXPLICIT_ARRAY_DEFAULT)
+        , int64_(INT64_DEFAULT)
         , use_custom_bool_variants_(false)
+        , stop_when_completed_(false)
+        , emit_depth_(1)
+        , namespaces_(false)
+        , strip_namespaces_(false)
+        , attrkey_id_(DictKey::NO_ID)
+        , textkey_id_(DictKey::NO_ID)
       {}
 
+      // Must be called after attrkey_ or textkey_ is changed
+      void RegisterKeys()
+      {
+        attrkey_id_ = DictKey::Register(attrkey_);
+        textkey_id_ = DictKey::Register(textkey_);
+      }
+
+      DictKey attrkey() const { return DictKey(attrkey_, attrkey_id_); }
+      DictKey textkey() const { return DictKey(textkey_, textkey_id_); }
+
       bool trim_;
       std::string white_spaces_;
+      WhiteSpaceTable white_space_table_;
       bool unicode_;
       bool ordered_dict_;
       std::string attrkey_;
       std::string textkey_;
       bool explicit_array_;
+      // integers out of int32 range are not truncated by builders,
+      // which have no 64-bit integers
+      bool int64_;
       std::set<std::string> true_variants_;
       std::set<std::string> false_variants_;
       bool use_custom_bool_variants_;
+      // "limit" option: parsing is stopped as soon as all mappings are
+      // completed (see Xml2VarRun::completed())
+      bool stop_when_completed_;
+      // maximum numbers of items of root list mappings
+      std::map<std::string, size_t> limits_;
+      // "emit_depth" option: depth of elements, which AnyXml2VarBuilder
+      // passes to item listener (1 - children of root element)
+      size_t emit_depth_;
+      // "namespaces" option: parser resolves namespace prefixes, names are
+      // "{uri}local" (see ExpatParser); with "strip" value names in results
+      // are local names only
+      bool namespaces_;
+      bool strip_namespaces_;
+      size_t attrkey_id_;
+      size_t textkey_id_;
     };
   } // namespace detail
 
@@ -103,6 +236,7 @@ namespace nkit
     VarBuilder(const detail::Options & options)
       : p_(options)
       , options_(options)
+      , local_handles_(false)
     {}
 
     ~VarBuilder()
@@ -125,22 +259,32 @@ namespace nkit
 
     void InitAsInteger( std::string const & value )
     {
-      p_.InitAsInteger(value);
+      p_.InitAsInteger(value.data(), value.size());
+    }
+
+    void InitAsInteger( const char * value, size_t size )
+    {
+      p_.InitAsInteger(value, size);
     }
 
     void InitAsIntegerFormat( std::string const & value, const std::string & )
     {
-      p_.InitAsInteger(value);
+      p_.InitAsInteger(value.data(), value.size());
     }
 
     void InitAsString( std::string const & value )
     {
-      p_.InitAsString(value);
+      p_.InitAsString(value.data(), value.size());
+    }
+
+    void InitAsString( const char * value, size_t size )
+    {
+      p_.InitAsString(value, size);
     }
 
     void InitAsStringFormat( std::string const & value, const std::string & )
     {
-      p_.InitAsString(value);
+      p_.InitAsString(value.data(), value.size());
     }
 
     void InitAsUndefined()
@@ -155,7 +299,12 @@ namespace nkit
 
     void InitAsFloat( std::string const & value )
     {
-      p_.InitAsFloatFormat( value, NKIT_FORMAT_DOUBLE );
+      p_.InitAsFloat( value.data(), value.size() );
+    }
+
+    void InitAsFloat( const char * value, size_t size )
+    {
+      p_.InitAsFloat( value, size );
     }
 
     void InitAsFloatFormat( std::string const & value,
@@ -192,9 +341,11 @@ namespace nkit
         VarBuilder<Policy> & attr_builder = get_attr_builder();
         attr_builder.InitAsDict();
         for (size_t i = 0; attrs[i] && attrs[i + 1]; ++(++i))
-        attr_builder.SetDictKeyValue(std::string(attrs[i]),
+        attr_builder.SetDictKeyValue(std::string(
+            options_.strip_namespaces_ ? local_name(attrs[i]) : attrs[i]),
             std::string(attrs[i + 1]));
-        SetDictKeyValue(options_.attrkey_, attr_builder.get());
+        p_.DictCheck();
+        p_.SetDictKeyValue(options_.attrkey(), attr_builder.p_);
       }
     }
 
@@ -204,29 +355,64 @@ namespace nkit
       p_.AppendToList(obj);
     }
 
-    void SetDictKeyValue( std::string const & key, type const & var )
+    void SetDictKeyValue( const DictKey & key, type const & var )
     {
       p_.DictCheck();
       p_.SetDictKeyValue(key, var);
     }
 
-    void SetDictKeyValue( std::string const & key, std::string const & var )
+    void SetDictKeyValue( const DictKey & key, std::string const & var )
+    {
+      SetDictKeyValue(key, var.data(), var.size());
+    }
+
+    void SetDictKeyValue( const DictKey & key, const char * var,
+        size_t size )
     {
       VarBuilder<Policy> & string_value_builder = get_string_builder();
-      string_value_builder.InitAsString(var);
-      p_.SetDictKeyValue(key, string_value_builder.get());
+      string_value_builder.InitAsString(var, size);
+      p_.SetDictKeyValue(key, string_value_builder.p_);
     }
 
-    void AppendToDictKeyList( std::string const & key, type const & var )
+    void AppendToDictKeyList( const DictKey & key, type const & var )
     {
       p_.AppendToDictKeyList(key, var);
     }
 
-    void AppendToDictKeyList( std::string const & key, std::string const & var )
+    void AppendToDictKeyList( const DictKey & key, std::string const & var )
+    {
+      AppendToDictKeyList(key, var.data(), var.size());
+    }
+
+    void AppendToDictKeyList( const DictKey & key, const char * var,
+        size_t size )
     {
       VarBuilder<Policy> & string_value_builder = get_string_builder();
-      string_value_builder.InitAsString(var);
-      p_.AppendToDictKeyList(key, string_value_builder.get());
+      string_value_builder.InitAsString(var, size);
+      p_.AppendToDictKeyList(key, string_value_builder.p_);
+    }
+
+    void AppendToDictKeyList( const DictKey & key, const VarBuilder & var )
+    {
+      p_.AppendToDictKeyList(key, var.p_);
+    }
+
+    // Policy may keep values of this builder (and of its helper builders)
+    // in short-lived storage (e.g. V8 local handles), which is valid until
+    // Persist() is called; get() must not be used before Persist() then
+    void UseLocalHandles(bool use)
+    {
+      local_handles_ = use;
+      p_.UseLocalHandles(use);
+      if (attr_bulder_)
+        attr_bulder_->UseLocalHandles(use);
+      if (string_bulder_)
+        string_bulder_->UseLocalHandles(use);
+    }
+
+    void Persist()
+    {
+      p_.Persist();
     }
 
     type const & get() const
@@ -243,14 +429,20 @@ namespace nkit
     VarBuilder & get_attr_builder()
     {
       if (!attr_bulder_)
+      {
         attr_bulder_ = Ptr(new VarBuilder(options_));
+        attr_bulder_->UseLocalHandles(local_handles_);
+      }
       return *attr_bulder_;
     }
 
     VarBuilder & get_string_builder()
     {
       if (!string_bulder_)
+      {
         string_bulder_ = Ptr(new VarBuilder(options_));
+        string_bulder_->UseLocalHandles(local_handles_);
+      }
       return *string_bulder_;
     }
 
@@ -259,6 +451,7 @@ namespace nkit
     const detail::Options & options_;
     Ptr attr_bulder_;
     Ptr string_bulder_;
+    bool local_handles_;
   };
 
   //----------------------------------------------------------------------------
@@ -272,29 +465,35 @@ namespace nkit
     Path() : is_mask_(false) {}
 
     Path(size_t element_id)
-      : is_mask_(String2IdMap::STAR_ID == element_id)
+      : is_mask_(is_mask_element(element_id))
     {
       elements_.push_back(element_id);
     }
 
+    // Names with namespace are written as "{uri}local": '/' inside braces
+    // is not a delimiter
     Path(const std::string & path_spec, String2IdMap * str2id)
       : is_mask_(false)
     {
       std::string path_spec_wo_attr, attr;
-      simple_split(path_spec, "/@", &path_spec_wo_attr, &attr);
+      simple_split(HideUriSlashes(path_spec), "/@", &path_spec_wo_attr,
+          &attr);
       StringVector path_spec_list;
       simple_split(path_spec_wo_attr, "/", &path_spec_list);
-      StringVector::const_iterator element = path_spec_list.begin(),
-          end = path_spec_list.end();
-      for (; element != end; ++element)
+      size_t count = path_spec_list.size();
+      for (size_t i = 0; i < count; ++i)
       {
-        if (!element->empty())
-        {
-          size_t id = str2id->GetId(element->c_str());
-          operator /=(id);
-        }
+        std::string & element = path_spec_list[i];
+        RestoreUriSlashes(&element);
+        if (!element.empty())
+          operator /=(str2id->GetId(element.c_str()));
+        // empty element between '/' and next element name or '*'
+        // means '//' (descendant axis)
+        else if (i > 0 && i + 1 < count && !path_spec_list[i + 1].empty())
+          operator /=(String2IdMap::DESCENDANT_ID);
       }
 
+      RestoreUriSlashes(&attr);
       if (!attr.empty())
         SetAttribute(attr);
     }
@@ -305,7 +504,8 @@ namespace nkit
     }
 
     // If one of the path is a mask (i.e. contains '*'), then make a
-    // special compare: '*' is equal to any element name
+    // special compare: '*' is equal to any element name.
+    // Paths with '//' are matched by mask DFA of Xml2VarPlan only.
     bool operator ==(const Path & another) const
     {
       if (!is_mask() && !another.is_mask())
@@ -360,7 +560,7 @@ namespace nkit
     Path & operator /=(size_t element_id)
     {
       assert(attribute_name_.empty());
-      is_mask_ = (is_mask_ || (String2IdMap::STAR_ID == element_id));
+      is_mask_ = (is_mask_ || is_mask_element(element_id));
       elements_.push_back(element_id);
       return *this;
     }
@@ -400,6 +600,39 @@ namespace nkit
       return result;
     }
 
+  private:
+    static bool is_mask_element(size_t element_id)
+    {
+      return element_id == String2IdMap::STAR_ID ||
+          element_id == String2IdMap::DESCENDANT_ID;
+    }
+
+    // control character, which can't be a part of path spec
+    static const char HIDDEN_SLASH = '\x01';
+
+    static std::string HideUriSlashes(const std::string & path_spec)
+    {
+      std::string result(path_spec);
+      bool in_uri = false;
+      for (size_t i = 0; i < result.size(); ++i)
+      {
+        if (result[i] == '{')
+          in_uri = true;
+        else if (result[i] == '}')
+          in_uri = false;
+        else if (in_uri && result[i] == '/')
+          result[i] = HIDDEN_SLASH;
+      }
+      return result;
+    }
+
+    static void RestoreUriSlashes(std::string * element)
+    {
+      for (size_t i = 0; i < element->size(); ++i)
+        if ((*element)[i] == HIDDEN_SLASH)
+          (*element)[i] = '/';
+    }
+
   private:
     bool is_mask_;
     std::vector<size_t> elements_;
@@ -414,660 +647,770 @@ namespace nkit
       const char * attribute_name);
 
   //----------------------------------------------------------------------------
+  // Receives items of root list mapping one by one, as soon as closing tag
+  // of item is parsed. Such items are not appended to the list.
+  // AnyXml2VarBuilder passes elements of "emit_depth" with their names
+  // as 'target_name'.
   template<typename T>
-  class TargetItem;
-
-  //----------------------------------------------------------------------------
-  template<typename T>
-  class Target: Uncopyable
+  class ItemListener
   {
   public:
-    typedef NKIT_SHARED_PTR(Target<T>) Ptr;
+    virtual ~ItemListener() {}
+    virtual void OnItem(const std::string & target_name,
+        typename T::type const & item) = 0;
+  };
 
+  //----------------------------------------------------------------------------
+  // Compiled mappings: targets (objects, lists and scalars to be built),
+  // items (places of targets in document and in their parent targets),
+  // tree of mapped paths and DFA of mask paths.
+  // Plan does not depend on type of built values and is not changed after
+  // creation, so it can be used by any number of Xml2VarRun objects at once,
+  // in any threads. Note that Ptr is not thread-safe itself: it must be
+  // copied and released by one thread.
+  class Xml2VarPlan: Uncopyable
+  {
   public:
-    virtual ~Target() {}
-    virtual void OnEnter(const char ** attrs) = 0;
-    virtual void OnExit(const char * el) = 0;
-    virtual void OnText(const char * text, size_t len) = 0;
-    virtual void Clear() = 0;
-
-    virtual void PutTargetItem(
-        NKIT_SHARED_PTR(TargetItem<T>) NKIT_UNUSED(target_item))
-    {}
+    typedef NKIT_SHARED_PTR(Xml2VarPlan) Ptr;
+    typedef std::vector<size_t> Indexes;
+    typedef std::map<std::string, size_t> RootTargets;
 
-    //virtual Ptr Clone() const = 0;
+    static const size_t NO_INDEX;
 
-    virtual bool must_use_default_value() const
+    enum TargetType
     {
-      return false;
-    }
+      OBJECT_TARGET,
+      LIST_TARGET,
+      SCALAR_TARGET
+    };
 
-    void SetOrInsertTo(const std::string & key_name,
-        T & var_builder) const
+    enum ScalarType
     {
-      var_builder.SetDictKeyValue(key_name, var());
-    }
+      STRING_SCALAR,
+      INTEGER_SCALAR,
+      NUMBER_SCALAR,
+      BOOLEAN_SCALAR,
+      DATETIME_SCALAR
+    };
 
-    void SetOrInsertTo(const char * key_name,
-        T & var_builder) const
+    enum KeyType
     {
-      var_builder.SetDictKeyValue(key_name, var());
-    }
+      // key is constant (or empty for items of lists and root targets)
+      FIXED_KEY,
+      // key is name of closed element ('*')
+      ELEMENT_KEY,
+      // key is value of attribute (or name of attribute, if element has
+      // no such attribute)
+      ATTRIBUTE_KEY
+    };
 
-    void SetOrInsertTo(const char * key_name,
-        Target * parent_target) const
-    {
-      parent_target->var_builder_.SetDictKeyValue(key_name, var());
-    }
+    // Item, compiled for interpreter loop of Xml2VarRun: all strings are
+    // replaced by indexes in keys() and attribute slots of program
+    struct Instruction
+    {
+      TargetType type_;
+      size_t item_;
+      size_t target_;
+      size_t parent_target_;
+      KeyType key_type_;
+      size_t key_;
+      // slot of attribute with value of target (or NO_INDEX)
+      size_t value_attribute_;
+      // slot of attribute with key (or NO_INDEX)
+      size_t key_attribute_;
+      bool deferred_;
+    };
 
-    void AppendTo(T & var_builder) const
-    {
-      var_builder.AppendToList(var());
-    }
+    typedef std::vector<Instruction> Instructions;
 
-    virtual typename T::type const & var() const
+    // Instructions for items of path node or mask DFA state
+    struct Program
     {
-      return var_builder_.get();
-    }
+      // items, which do something on start tag
+      Instructions enter_;
+      // all items in order of adding
+      Instructions exit_;
+      // scalar targets, which get text of element
+      Indexes text_;
+      // names of attributes, values of which are looked up once per
+      // start tag
+      StringVector attributes_;
+    };
 
-    virtual std::string ToString() const
-    {
-      return var_builder_.ToString();
-    }
+    struct TargetSpec
+    {
+      TargetType type_;
+      ScalarType scalar_type_;
+      bool has_default_value_;
+      std::string default_value_;
+      std::string format_;
+      // items of object or list, in order of path length
+      Indexes items_;
+      Instructions children_;
+      // maximum number of items of root list (0 - no limit)
+      size_t limit_;
+    };
 
-  protected:
-    Target(const detail::Options::Ptr & options)
-      : options_(options)
-      , var_builder_(*options)
-    {}
+    struct ItemSpec
+    {
+      size_t target_;
+      // NO_INDEX for root targets
+      size_t parent_target_;
+      Path path_;
+      // key in parent object: constant, '*' (name of closed element)
+      // or name of attribute with key; empty for items of lists
+      std::string key_;
+      bool key_is_attribute_;
+      // value is put to parent object by parent itself (see SetFixedShape())
+      bool deferred_;
+    };
 
-  protected:
-    const detail::Options::Ptr options_;
-    T var_builder_;
-  };
+    struct Node
+    {
+      size_t element_id_;
+      Indexes children_;
+      Indexes items_;
+      Program program_;
+      // this node or one of its descendants has items
+      bool has_items_below_;
+    };
 
-  //----------------------------------------------------------------------------
-  template<typename T>
-  class TargetItem: Uncopyable
-  {
-  public:
-    typedef NKIT_SHARED_PTR(TargetItem<T>) Ptr;
-    typedef std::vector<Ptr> Vector;
-    typedef typename Target<T>::Ptr TargetPtr;
+    // State of mask DFA
+    struct MaskState
+    {
+      // element id -> state
+      Indexes transitions_;
+      // items with completely matched paths, in order of adding
+      Indexes items_;
+      Program program_;
+      // some mask path can match current path or its continuation
+      bool alive_;
+    };
 
   public:
-    static Ptr Create(const Path & path, const std::string & key_name,
-        TargetPtr target)
-    {
-      return Ptr(new TargetItem(path, key_name, target));
-    }
+    static Ptr Create(const std::string & options,
+        const std::string & mappings, std::string * error);
 
-    static Ptr Create(const Path & path, TargetPtr target)
-    {
-      return Ptr(new TargetItem(path, target));
-    }
+    static Ptr Create(const Dynamic & options, const Dynamic & mappings,
+        std::string * error);
 
-    ~TargetItem() {}
+    static Ptr Create(const detail::Options::Ptr & options,
+        const Dynamic & mappings, std::string * error);
 
-    TargetPtr target() const { return target_; }
+    const detail::Options & options() const { return *options_; }
 
-    void SetParentTarget(Target<T> * parent_target)
-    {
-      parent_target_ = parent_target;
-    }
+    const TargetSpec & target(size_t index) const { return targets_[index]; }
+    size_t targets_size() const { return targets_.size(); }
 
-    Target<T> * parent_target() const
-    {
-      return parent_target_;
-    }
+    const ItemSpec & item(size_t index) const { return items_[index]; }
+    size_t items_size() const { return items_.size(); }
+
+    const RootTargets & root_targets() const { return root_targets_; }
 
-    bool must_use_default_value() const
+    DictKey key(size_t index) const
     {
-      return target_->must_use_default_value();
+      return DictKey(keys_[index], key_ids_[index]);
     }
 
-    const std::string & key_name() const { return key_name_; }
+    // Maximum size of Program::attributes_
+    size_t max_attributes() const { return max_attributes_; }
 
-    void SetKey(const std::string & key, bool is_attribute)
-    {
-      key_name_ = key;
-      actual_key_name_ = key;
-      key_name_is_attribute_ = is_attribute;
-    }
+    StringList mapping_names() const;
 
-    void SetOrInsertTo(const char * el, T & var_builder) const
-    {
-      if (likely(actual_key_name_ != S_STAR_))
-        target_->SetOrInsertTo(actual_key_name_, var_builder);
-      else
-        target_->SetOrInsertTo(el, var_builder);
-    }
+    // Items of list mappings only can be passed to ItemListener
+    bool CheckListMapping(const std::string & target_name,
+        std::string * error) const;
 
-    void AppendTo(T & var_builder) const
+    // All element names, which are not used in paths, have the same id.
+    // Name with namespace ("{uri}local") matches paths with local name
+    // too, if there is no path with this namespace.
+    size_t GetElementId(const char * name) const
     {
-      target_->AppendTo(var_builder);
+      size_t element_id = str2id_.FindId(name);
+      if (unlikely(element_id == String2IdMap::UNKNOWN_ID && *name == '{'))
+        element_id = str2id_.FindId(local_name(name));
+      if (element_id == String2IdMap::UNKNOWN_ID)
+        return other_element_id_;
+      return element_id;
     }
 
-    void Clear()
-    {
-      target_->Clear();
-    }
+    // Node 0 is the root of tree (root element of document)
+    const Node & node(size_t index) const { return nodes_[index]; }
 
-    void OnEnter(const char ** attrs)
+    // Returns child of 'node' (or NO_INDEX, if there is no such child or
+    // 'node' itself is NO_INDEX)
+    size_t GetChild(size_t node, size_t element_id) const
     {
-      target_->OnEnter(attrs);
-      const std::string & attribute_name = path_.attribute_name();
-      if (!attribute_name.empty())
-      {
-        const char * attribute_value = find_attribute_value(attrs,
-            attribute_name.c_str());
-        if (attribute_value)
-          target_->OnText(attribute_value, strlen(attribute_value));
-      }
-
-      if (key_name_is_attribute_)
+      if (node == NO_INDEX)
+        return NO_INDEX;
+      const Indexes & children = nodes_[node].children_;
+      Indexes::const_iterator child = children.begin(), end = children.end();
+      for (; child != end; ++child)
       {
-        const char * actual_key_name = find_attribute_value(attrs,
-            key_name_.c_str());
-        if (actual_key_name)
-          actual_key_name_ = actual_key_name;
-        else
-          actual_key_name_ = key_name_;
+        if (nodes_[*child].element_id_ == element_id)
+          return *child;
       }
+      return NO_INDEX;
     }
 
-    void OnExit(const char * el)
-    {
-      target_->OnExit(el);
-      if (!actual_key_name_.empty())
-      {
-        target_->SetOrInsertTo(
-          (actual_key_name_ == S_STAR_) ? el: actual_key_name_.c_str(),
-          parent_target_
-        );
-      }
-    }
+    // State 0 is the initial state of mask DFA
+    bool has_masks() const { return !mask_states_.empty(); }
 
-    void OnText(const char * text, size_t len)
+    const MaskState & mask_state(size_t index) const
     {
-      if (path_.attribute_name().empty())
-        target_->OnText(text, len);
+      return mask_states_[index];
     }
 
-    const Path & fool_path() const
-    {
-      return path_;
-    }
+  private:
+    typedef std::pair<size_t, size_t> NfaState;
+    typedef std::vector<NfaState> NfaStates; // sorted
+    typedef std::map<NfaStates, size_t> StateIndex;
 
-    std::string ToString() const
-    {
-      return std::string("path: ") + path_.ToString() + "\nkey_name: "
-          + key_name_ + "\ntarget: " + target_->ToString()
-          + "\nparent target: " + string_cast((uint64_t)parent_target_)
-          + "\n----------------------------------";
-    }
+    Xml2VarPlan(const detail::Options::Ptr & options);
 
-  private:
-    TargetItem(const Path & path, TargetPtr target)
-      : path_(path)
-      , target_(target)
-      , parent_target_(NULL)
-      , key_name_is_attribute_(false)
-    {}
+    bool AddMapping(const std::string & target_name,
+        const Dynamic & mapping, std::string * error);
+    size_t ParseTargetSpec(size_t parent_target, Path parent_path,
+        const Dynamic & mapping, std::string * error);
+    size_t ParseScalarTargetSpec(size_t parent_target, Path parent_path,
+        const std::string & mapping, std::string * error);
+    size_t ParseListTargetSpec(size_t parent_target, Path parent_path,
+        const Dynamic & mapping, std::string * error);
+    size_t ParseObjectTargetSpec(size_t parent_target, Path parent_path,
+        const Dynamic & mapping, std::string * error);
+
+    size_t AddTarget(TargetType type);
+    size_t AddItem(size_t target, size_t parent_target, const Path & path);
+    void AppendItem(size_t item, Indexes * items) const;
+    bool AppendObjectItem(size_t target, size_t item);
+    void SetFixedShape(size_t target);
+    void PutItemToTree(size_t item);
+
+    void CompileMasks();
+    size_t AddMaskState(NfaStates * nfa_states, StateIndex * state_index,
+        std::vector<NfaStates> * states);
+
+    void CompilePrograms();
+    void CompileProgram(const Indexes & items, Program * program);
+    Instruction CompileItem(size_t item, StringVector * attributes);
+    size_t GetKeyIndex(const std::string & key);
+    static size_t GetAttributeSlot(const std::string & attribute,
+        StringVector * attributes);
 
   private:
-    Path path_;
-    TargetPtr target_;
-    Target<T> * parent_target_;
-    std::string key_name_;
-    bool key_name_is_attribute_;
-    std::string actual_key_name_;
+    detail::Options::Ptr options_;
+    String2IdMap str2id_;
+    size_t other_element_id_;
+    std::vector<TargetSpec> targets_;
+    std::vector<ItemSpec> items_;
+    std::vector<Node> nodes_;
+    Indexes mask_items_;
+    std::vector<MaskState> mask_states_;
+    RootTargets root_targets_;
+    StringVector keys_;
+    // DictKey ids of keys_
+    Indexes key_ids_;
+    size_t max_attributes_;
   };
 
   //----------------------------------------------------------------------------
+  // Mutable state of parsing of one document by plan: values of targets,
+  // states of items, current path in tree of plan and in mask DFA.
+  // SAX events are handled by loops over instructions of plan programs.
   template<typename T>
-  class ObjectTarget: public Target<T>
+  class Xml2VarRun: Uncopyable
   {
-  public:
-    typedef NKIT_SHARED_PTR(ObjectTarget<T>) Ptr;
-    typedef typename Target<T>::Ptr TargetPtr;
-    typedef typename TargetItem<T>::Ptr TargetItemPtr;
-    typedef typename TargetItem<T>::Vector TargetItemVector;
-    typedef typename TargetItemVector::iterator Iterator;
-    typedef typename TargetItemVector::const_iterator ConstIterator;
-
-  public:
-    static Ptr Create(const detail::Options::Ptr & options)
-    {
-      return Ptr(new ObjectTarget<T>(options));
-    }
+    typedef Xml2VarPlan::TargetSpec TargetSpec;
+    typedef Xml2VarPlan::Instruction Instruction;
+    typedef Xml2VarPlan::Instructions Instructions;
+    typedef Xml2VarPlan::Program Program;
+    typedef Xml2VarPlan::Indexes Indexes;
+    typedef typename T::Ptr VarBuilderPtr;
 
-    ~ObjectTarget() {}
+    struct TargetState
+    {
+      T * var_builder_;
+      // scalar with default value only
+      T * default_value_;
+      // text of scalar
+      TextSlice text_;
+      bool use_default_value_;
+      // number of items of list
+      size_t count_;
+      ItemListener<T> * listener_;
+      const std::string * target_name_;
+    };
 
-    void PutTargetItem(TargetItemPtr target_item)
+    struct ItemState
     {
-      if (AppendTargetItem(target_item))
-        target_item->SetParentTarget(this);
-    }
+      // for ATTRIBUTE_KEY only
+      std::string actual_key_;
+      bool filled_;
+      bool exited_;
+    };
+
+  public:
+    explicit Xml2VarRun(const Xml2VarPlan::Ptr & plan)
+      : plan_(plan)
+      , targets_(plan->targets_size())
+      , items_(plan->items_size())
+      , attribute_values_(plan->max_attributes())
+    {
+      const detail::Options & options = plan_->options();
+      for (size_t i = 0; i < targets_.size(); ++i)
+      {
+        const TargetSpec & spec = plan_->target(i);
+        TargetState & target = targets_[i];
+        target.var_builder_ = NewVarBuilder(options);
+        // items of lists may be collected in short-lived storage, until
+        // list is used or chunk is parsed (see Persist())
+        if (spec.type_ == Xml2VarPlan::LIST_TARGET)
+          target.var_builder_->UseLocalHandles(true);
+        target.default_value_ = NULL;
+        if (spec.has_default_value_)
+        {
+          target.default_value_ = NewVarBuilder(options);
+          InitScalar(spec, spec.default_value_.data(),
+              spec.default_value_.size(), target.default_value_);
+        }
+        target.use_default_value_ = true;
+        target.count_ = 0;
+        target.listener_ = NULL;
+        target.target_name_ = NULL;
+      }
 
-  private:
-    ObjectTarget(const detail::Options::Ptr & options)
-      : Target<T>(options)
-    {
       Clear();
     }
 
-    bool AppendTargetItem(TargetItemPtr const & target_item)
-    {
-      // key must not exists
-      const std::string & key_name = target_item->key_name();
-      Iterator it = target_items_.begin(),
-          end = target_items_.end();
-      for (; it != end; ++it)
-        if ((*it)->key_name() == key_name)
-          return false;
-
-      size_t size = target_item->fool_path().size();
+    const Xml2VarPlan::Ptr & plan() const { return plan_; }
 
-      it = target_items_.begin(),
-          end = target_items_.end();
-      for (; it != end; ++it)
+    // Drops all constructed data, so run can be used for the next document
+    void Clear()
+    {
+      first_node_ = true;
+      nodes_.assign(1, 0);
+      mask_states_.assign(1, 0);
+      for (size_t i = 0; i < items_.size(); ++i)
       {
-        if (size < (*it)->fool_path().size())
-          break;
+        items_[i].exited_ = false;
+        items_[i].filled_ = false;
       }
+      for (size_t i = 0; i < targets_.size(); ++i)
+        ClearTarget(plan_->target(i).type_, &targets_[i]);
+    }
 
-      if (it == end)
-        target_items_.push_back(target_item);
-      else
-        target_items_.insert(it, target_item);
+    bool SetItemListener(const std::string & target_name,
+        ItemListener<T> * listener, std::string * error)
+    {
+      if (!plan_->CheckListMapping(target_name, error))
+        return false;
 
+      Xml2VarPlan::RootTargets::const_iterator found =
+          plan_->root_targets().find(target_name);
+      targets_[found->second].listener_ = listener;
+      targets_[found->second].target_name_ = &found->first;
       return true;
     }
 
-    void OnEnter(const char ** attrs)
+    const typename T::type & var(const std::string & target_name) const
     {
-      Clear();
-      Target<T>::var_builder_.SetAttrKey(attrs);
+      const Xml2VarPlan::RootTargets & root_targets = plan_->root_targets();
+      Xml2VarPlan::RootTargets::const_iterator found =
+          root_targets.find(target_name);
+      if (unlikely(found == root_targets.end()))
+        return T::GetUndefined();
+      return var(found->second);
     }
 
-    void OnExit(const char * el)
+    // All root targets are completed (see TargetCompleted())
+    bool completed() const
     {
-      Iterator it = target_items_.begin(), end = target_items_.end();
+      const Xml2VarPlan::RootTargets & root_targets = plan_->root_targets();
+      Xml2VarPlan::RootTargets::const_iterator it = root_targets.begin(),
+          end = root_targets.end();
       for (; it != end; ++it)
       {
-        TargetItemPtr target_item = (*it);
-        if (target_item->must_use_default_value())
-          target_item->SetOrInsertTo(el, Target<T>::var_builder_);
-        target_item->Clear();
+        if (!TargetCompleted(it->second))
+          return false;
       }
+      return true;
     }
 
-    void OnText(const char *, size_t) {}
-
-    void Clear()
+    // Returns false if neither element nor its descendants are mapped,
+    // so element must be skipped with all its descendants
+    bool Enter(const char * el, const char ** attrs)
     {
-      Target<T>::var_builder_.InitAsDict();
-    }
+      // root element itself is not a part of paths
+      if (first_node_)
+      {
+        first_node_ = false;
+        return true;
+      }
 
-  private:
-    TargetItemVector target_items_;
-  };
+      const Xml2VarPlan & plan = *plan_;
+      size_t element_id = plan.GetElementId(el);
+      size_t node = plan.GetChild(nodes_.back(), element_id);
+      size_t mask_state = 0;
+      if (plan.has_masks())
+        mask_state = plan.mask_state(mask_states_.back()).transitions_[
+            element_id];
 
-  //----------------------------------------------------------------------------
-  template<typename T>
-  class ListTarget: public Target<T>
-  {
-    typedef Target<T> MyParent;
-    typedef typename Target<T>::Ptr TargetPtr;
+      if ((node == Xml2VarPlan::NO_INDEX || !plan.node(node).has_items_below_)
+          && !(plan.has_masks() && plan.mask_state(mask_state).alive_))
+        return false;
 
-  public:
-    typedef typename TargetItem<T>::Ptr TargetItemPtr;
-    typedef typename TargetItem<T>::Vector TargetItemVector;
-    typedef typename TargetItemVector::iterator Iterator;
-    typedef typename TargetItemVector::const_iterator ConstIterator;
-    typedef NKIT_SHARED_PTR(ListTarget<T>) Ptr;
+      nodes_.push_back(node);
+      if (plan.has_masks())
+      {
+        mask_states_.push_back(mask_state);
+        RunEnter(plan.mask_state(mask_state).program_, attrs);
+      }
 
-    static Ptr Create(const detail::Options::Ptr & options)
-    {
-      return Ptr(new ListTarget<T>(options));
+      if (node != Xml2VarPlan::NO_INDEX)
+        RunEnter(plan.node(node).program_, attrs);
+      return true;
     }
 
-    ~ListTarget() {}
-
-    void PutTargetItem(TargetItemPtr target_item)
+    void Exit(const char * el)
     {
-      AppendTargetItem(target_item);
-      target_item->SetParentTarget(this);
+      const Xml2VarPlan & plan = *plan_;
+      if (plan.has_masks())
+      {
+        RunExit(plan.mask_state(mask_states_.back()).program_, el);
+        if (mask_states_.size() > 1)
+          mask_states_.pop_back();
+      }
+
+      if (nodes_.back() != Xml2VarPlan::NO_INDEX)
+        RunExit(plan.node(nodes_.back()).program_, el);
+      if (nodes_.size() > 1)
+        nodes_.pop_back();
     }
 
-  private:
-    ListTarget(const detail::Options::Ptr & options)
-      : Target<T>(options)
+    // 'in_buffer': see TextSlice::Append()
+    void Text(const char * text, size_t len, bool in_buffer)
     {
-      Clear();
+      const Xml2VarPlan & plan = *plan_;
+      if (nodes_.back() != Xml2VarPlan::NO_INDEX)
+        RunText(plan.node(nodes_.back()).program_, text, len, in_buffer);
+      if (plan.has_masks())
+        RunText(plan.mask_state(mask_states_.back()).program_, text, len,
+            in_buffer);
     }
 
-    void AppendTargetItem(TargetItemPtr const & target_item)
+    // Must be called after parsing of every chunk: texts of unclosed
+    // elements are copied from Expat buffer
+    void Detach()
     {
-      size_t size = target_item->fool_path().size();
+      for (size_t i = 0; i < targets_.size(); ++i)
+        targets_[i].text_.Detach();
+    }
 
-      Iterator it = target_items_.begin(),
-          end = target_items_.end();
-      for (; it != end; ++it)
+    // Must be called after parsing of every chunk: lists, which are not
+    // completed yet, are moved from short-lived storage of builder policy
+    void Persist()
+    {
+      for (size_t i = 0; i < targets_.size(); ++i)
       {
-        if (size < (*it)->fool_path().size())
-          break;
+        if (plan_->target(i).type_ == Xml2VarPlan::LIST_TARGET)
+          targets_[i].var_builder_->Persist();
       }
-
-      if (it == end)
-        target_items_.push_back(target_item);
-      else
-        target_items_.insert(it, target_item);
     }
 
-    void OnEnter(const char ** NKIT_UNUSED(attrs)) {}
+  private:
+    T * NewVarBuilder(const detail::Options & options)
+    {
+      var_builders_.push_back(VarBuilderPtr(new T(options)));
+      return var_builders_.back().get();
+    }
 
-    void OnExit(const char * NKIT_UNUSED(el))
+    // Strings and numbers are made from text directly; formats and
+    // boolean variants need std::string
+    static void InitScalar(const TargetSpec & spec, const char * value,
+        size_t size, T * var_builder)
     {
-      Iterator it = target_items_.begin(), end = target_items_.end();
-      for (; it != end; ++it)
+      switch (spec.scalar_type_)
       {
-        TargetItemPtr target_item = (*it);
-        target_item->AppendTo(Target<T>::var_builder_);
-        target_item->Clear();
+      case Xml2VarPlan::STRING_SCALAR:
+        var_builder->InitAsString(value, size);
+        break;
+      case Xml2VarPlan::INTEGER_SCALAR:
+        var_builder->InitAsInteger(value, size);
+        break;
+      case Xml2VarPlan::NUMBER_SCALAR:
+        if (spec.format_.empty())
+          var_builder->InitAsFloat(value, size);
+        else
+          var_builder->InitAsFloatFormat(std::string(value, size),
+              spec.format_);
+        break;
+      case Xml2VarPlan::BOOLEAN_SCALAR:
+        var_builder->InitAsBoolean(std::string(value, size));
+        break;
+      case Xml2VarPlan::DATETIME_SCALAR:
+        if (spec.format_.empty())
+          var_builder->InitAsDatetime(std::string(value, size));
+        else
+          var_builder->InitAsDatetimeFormat(std::string(value, size),
+              spec.format_);
+        break;
       }
     }
 
-    void OnText(const char *, size_t) {}
-
-    void Clear()
+    static bool MustUseDefaultValue(const TargetState & target)
     {
-      Target<T>::var_builder_.InitAsList();
+      return target.default_value_ != NULL && target.use_default_value_;
     }
 
-  private:
-    TargetItemVector target_items_;
-  };
-
-  //----------------------------------------------------------------------------
-  template<typename T,
-    void (T::*InitByString)(const std::string & value),
-    void (T::*InitByStringWithFormat)(const std::string & value,
-        const std::string & format)
-    >
-  class ScalarTarget: public Target<T>
-  {
-    typedef Target<T> MyParent;
-    typedef typename Target<T>::Ptr TargetPtr;
-
-    static const size_t RESERVED_LENGTH = 10240;
-
-  public:
-    virtual ~ScalarTarget() {}
-
-    static typename MyParent::Ptr Create(const detail::Options::Ptr & options,
-        const std::string & default_value,
-        const std::string & format)
+    const typename T::type & var(size_t target) const
     {
-      return typename MyParent::Ptr(new ScalarTarget(options,
-          default_value, format));
+      const TargetState & state = targets_[target];
+      if (unlikely(MustUseDefaultValue(state)))
+        return state.default_value_->get();
+      if (plan_->target(target).type_ == Xml2VarPlan::LIST_TARGET)
+        state.var_builder_->Persist();
+      return state.var_builder_->get();
     }
 
-    static typename MyParent::Ptr Create(const detail::Options::Ptr & options,
-        const std::string & default_value)
+    DictKey GetKey(const Instruction & instruction, const char * el)
     {
-      return typename MyParent::Ptr(new ScalarTarget(options, default_value));
+      switch (instruction.key_type_)
+      {
+      case Xml2VarPlan::ELEMENT_KEY:
+        if (plan_->options().strip_namespaces_)
+          el = local_name(el);
+        element_key_.assign(el);
+        return element_key_;
+      case Xml2VarPlan::ATTRIBUTE_KEY:
+        return items_[instruction.item_].actual_key_;
+      default:
+        return plan_->key(instruction.key_);
+      }
     }
 
-    static typename MyParent::Ptr Create(const detail::Options::Ptr & options)
+    // Rest of document can't change value of target: scalar is completed
+    // as soon as its element is closed, object - when all its items are
+    // completed, list - when it has got limit of items
+    bool TargetCompleted(size_t target) const
     {
-      return typename MyParent::Ptr(new ScalarTarget(options));
-    }
+      const TargetSpec & spec = plan_->target(target);
+      if (spec.type_ == Xml2VarPlan::LIST_TARGET)
+        return spec.limit_ != 0 && targets_[target].count_ >= spec.limit_;
 
-  private:
-    ScalarTarget(const detail::Options::Ptr & options,
-        const std::string & default_value,
-        const std::string & format)
-      : Target<T>(options)
-      , default_value_(*options)
-      , use_default_value_(true)
-      , has_default_value_(true)
-      , value_("")
-      , format_(format)
-    {
-      Init();
-      std::string trimed_default_value;
-      const std::string * p_default_value = & default_value;
-      if (Target<T>::options_->trim_)
+      typename Instructions::const_iterator it = spec.children_.begin(),
+          end = spec.children_.end();
+      for (; it != end; ++it)
       {
-        trimed_default_value = trim_copy(default_value,
-            Target<T>::options_->white_spaces_);
-        p_default_value = & trimed_default_value;
+        if (!items_[it->item_].exited_ || !TargetCompleted(it->target_))
+          return false;
       }
-
-      if (format_.empty())
-        (default_value_.*InitByString)(*p_default_value);
-      else
-        (default_value_.*InitByStringWithFormat)(*p_default_value, format_);
+      return true;
     }
 
-    ScalarTarget(const detail::Options::Ptr & options,
-        const std::string & default_value)
-      : Target<T>(options)
-      , default_value_(*options)
-      , use_default_value_(true)
-      , has_default_value_(true)
-      , value_("")
+    static void ClearTarget(Xml2VarPlan::TargetType type, TargetState * state)
     {
-      Init();
-      (default_value_.*InitByString)(default_value);
+      switch (type)
+      {
+      case Xml2VarPlan::OBJECT_TARGET:
+        state->var_builder_->InitAsDict();
+        break;
+      case Xml2VarPlan::LIST_TARGET:
+        state->count_ = 0;
+        state->var_builder_->InitAsList();
+        break;
+      case Xml2VarPlan::SCALAR_TARGET:
+        state->text_.Clear();
+        state->use_default_value_ = true;
+        break;
+      }
     }
 
-    ScalarTarget(const detail::Options::Ptr & options)
-      : Target<T>(options)
-      , default_value_(*options)
-      , use_default_value_(false)
-      , has_default_value_(false)
-      , value_("")
+    void ClearItem(const Instruction & instruction)
     {
-      Init();
+      items_[instruction.item_].filled_ = false;
+      ClearTarget(instruction.type_, &targets_[instruction.target_]);
     }
 
-    void Init()
+    // Values of all attributes, used by program, are found by one pass
+    // over attributes of element
+    void ResolveAttributes(const Program & program, const char ** attrs)
     {
-      value_.reserve(RESERVED_LENGTH);
+      const StringVector & names = program.attributes_;
+      std::fill(attribute_values_.begin(),
+          attribute_values_.begin() + names.size(),
+          static_cast<const char *>(NULL));
+      for (size_t i = 0; attrs[i] && attrs[i + 1]; ++(++i))
+      {
+        const char * local = local_name(attrs[i]);
+        for (size_t slot = 0; slot < names.size(); ++slot)
+        {
+          if (names[slot] == attrs[i])
+          {
+            attribute_values_[slot] = attrs[i + 1];
+            break;
+          }
+          // attribute with namespace matches its local name too
+          if (unlikely(local != attrs[i]) && names[slot] == local
+              && !attribute_values_[slot])
+            attribute_values_[slot] = attrs[i + 1];
+        }
+      }
     }
 
-    void OnEnter(const char ** NKIT_UNUSED(attrs))
+    void RunEnter(const Program & program, const char ** attrs)
     {
-      use_default_value_ = true;
-    }
+      if (unlikely(!program.attributes_.empty()))
+        ResolveAttributes(program, attrs);
 
-    void OnExit(const char * NKIT_UNUSED(el))
-    {
-      if (likely(!must_use_default_value()))
+      typename Instructions::const_iterator it = program.enter_.begin(),
+          end = program.enter_.end();
+      for (; it != end; ++it)
       {
-        if (Target<T>::options_->trim_)
-          trim(value_, Target<T>::options_->white_spaces_);
+        TargetState & target = targets_[it->target_];
+        switch (it->type_)
+        {
+        case Xml2VarPlan::OBJECT_TARGET:
+          target.var_builder_->InitAsDict();
+          target.var_builder_->SetAttrKey(attrs);
+          break;
+        case Xml2VarPlan::LIST_TARGET:
+          break;
+        case Xml2VarPlan::SCALAR_TARGET:
+          target.use_default_value_ = true;
+          if (it->value_attribute_ != Xml2VarPlan::NO_INDEX)
+          {
+            const char * value = attribute_values_[it->value_attribute_];
+            if (value)
+            {
+              target.use_default_value_ = false;
+              target.text_.Append(value, strlen(value), false);
+            }
+          }
+          break;
+        }
 
-        if (format_.empty())
-          (Target<T>::var_builder_.*InitByString)(value_);
-        else
-          (Target<T>::var_builder_.*InitByStringWithFormat)(
-              value_, format_);
+        if (it->key_attribute_ != Xml2VarPlan::NO_INDEX)
+        {
+          const char * actual_key = attribute_values_[it->key_attribute_];
+          items_[it->item_].actual_key_ =
+              actual_key ? actual_key : plan_->key(it->key_).name();
+        }
       }
-      value_.clear();
-    }
-
-    void OnText(const char * text, size_t len)
-    {
-      use_default_value_ = false;
-      value_.append(text, len);
-    }
-
-    void Clear()
-    {
-      value_.clear();
-      use_default_value_ = true;
-    }
-
-    virtual bool must_use_default_value() const
-    {
-      return has_default_value_ && use_default_value_;
-    }
-
-    virtual typename T::type const & var() const
-    {
-      if (unlikely(must_use_default_value()))
-        return default_value_.get();
-      else
-        return Target<T>::var_builder_.get();
     }
 
-  private:
-    T default_value_;
-    mutable bool use_default_value_;
-    mutable bool has_default_value_;
-    std::string value_;
-    std::string format_;
-  };
-
-  //---------------------------------------------------------------------------
-  template<typename T>
-  class PathNode: Uncopyable
-  {
-  public:
-    typedef NKIT_SHARED_PTR(PathNode<T>) Ptr;
-    typedef typename TargetItem<T>::Ptr TargetItemPtr;
-    typedef typename TargetItem<T>::Vector TargetItemVector;
-    typedef typename TargetItemVector::iterator Iterator;
-    typedef typename TargetItemVector::const_iterator ConstIterator;
-
-  public:
-    static Ptr CreateRoot()
+    void RunExit(const Program & program, const char * el)
     {
-      return Ptr(new PathNode<T>(0));
-    }
-
-    static void MoveToChild(PathNode<T> ** current, size_t element_id)
-    {
-      std::vector<Ptr> & children = (**current).children_;
-      typename std::vector<Ptr>::iterator child =
-          children.begin(), end = children.end();
-      for (; child != end; ++child)
+      typename Instructions::const_iterator it = program.exit_.begin(),
+          end = program.exit_.end();
+      for (; it != end; ++it)
       {
-        if ((*child)->element_id_ == element_id)
+        ExitTarget(*it, el);
+        ItemState & item = items_[it->item_];
+        item.exited_ = true;
+        if (it->deferred_)
+          item.filled_ = true;
+        else
         {
-          *current = (*child).get();
-          return;
+          DictKey key = GetKey(*it, el);
+          if (!key.empty())
+            targets_[it->parent_target_].var_builder_->SetDictKeyValue(
+                key, var(it->target_));
         }
       }
-      Ptr new_child(new PathNode<T>(*current, element_id));
-      children.push_back(new_child);
-      *current = new_child.get();
-    }
-
-    static bool MoveToParent(PathNode<T> ** current)
-    {
-      if (!(*current)->parent_)
-        return false;
-      *current = (*current)->parent_;
-      return true;
     }
 
-    void OnEnter(const char ** attrs)
+    void RunText(const Program & program, const char * text, size_t len,
+        bool in_buffer)
     {
-      Iterator target_item = target_items_.begin(), end = target_items_.end();
-      for (; target_item != end; ++target_item)
-        (*target_item)->OnEnter(attrs);
-    }
-
-    void OnExit(const char * el)
-    {
-      Iterator target_item = target_items_.begin(), end = target_items_.end();
-      for (; target_item != end; ++target_item)
-        (*target_item)->OnExit(el);
-    }
-
-    void OnText(const char * text, size_t len)
-    {
-      Iterator target_item = target_items_.begin(), end = target_items_.end();
-      for (; target_item != end; ++target_item)
-        (*target_item)->OnText(text, len);
-    }
-
-    void PutTargetItem(TargetItemPtr const & target_item)
-    {
-      PathNode<T> * current = this;
-      const Path & path = target_item->fool_path();
-      std::vector<size_t>::const_iterator element_id = path.elements().begin(),
-          end = path.elements().end();
-      for (; element_id != end; ++element_id)
-        MoveToChild(&current, *element_id);
-      current->AppendTargetItem(target_item);
-    }
-
-    void AppendTargetItem(TargetItemPtr const & target_item)
-    {
-      size_t size = target_item->fool_path().size();
-
-      Iterator it = target_items_.begin(), end = target_items_.end();
+      Indexes::const_iterator it = program.text_.begin(),
+          end = program.text_.end();
       for (; it != end; ++it)
       {
-        if (size < (*it)->fool_path().size())
-          break;
+        TargetState & target = targets_[*it];
+        target.use_default_value_ = false;
+        target.text_.Append(text, len, in_buffer);
       }
-
-      if (it == end)
-        target_items_.push_back(target_item);
-      else
-        target_items_.insert(it, target_item);
     }
 
-    const Path & fool_path() const
+    void ExitTarget(const Instruction & instruction, const char * el)
     {
-      return path_;
+      const TargetSpec & spec = plan_->target(instruction.target_);
+      TargetState & state = targets_[instruction.target_];
+      switch (instruction.type_)
+      {
+      case Xml2VarPlan::OBJECT_TARGET:
+        ExitObject(spec, el, state.var_builder_);
+        break;
+      case Xml2VarPlan::LIST_TARGET:
+        ExitList(spec, &state);
+        break;
+      case Xml2VarPlan::SCALAR_TARGET:
+        if (likely(!MustUseDefaultValue(state)))
+        {
+          const detail::Options & options = plan_->options();
+          if (options.trim_)
+            state.text_.Trim(options.white_space_table_);
+          InitScalar(spec, state.text_.data(), state.text_.size(),
+              state.var_builder_);
+        }
+        state.text_.Clear();
+        break;
+      }
     }
 
-    bool is_filled_from_mask_target_items() const
+    // Items with fixed keys are put to the object all at once in order of
+    // plan, so every object, built by this target, has the same shape
+    void ExitObject(const TargetSpec & spec, const char * el,
+        T * var_builder)
     {
-      return filled_from_mask_target_items_;
+      typename Instructions::const_iterator it = spec.children_.begin(),
+          end = spec.children_.end();
+      for (; it != end; ++it)
+      {
+        if (items_[it->item_].filled_ ||
+            MustUseDefaultValue(targets_[it->target_]))
+          var_builder->SetDictKeyValue(GetKey(*it, el),
+              var(it->target_));
+        ClearItem(*it);
+      }
     }
 
-    void MarkFilledFromMaskTargetItems()
+    void ExitList(const TargetSpec & spec, TargetState * state)
     {
-      filled_from_mask_target_items_ = true;
+      // items over the limit are dropped: Expat may call some handlers
+      // after parsing was stopped
+      bool append = spec.limit_ == 0 || state->count_ < spec.limit_;
+      ++state->count_;
+      typename Instructions::const_iterator it = spec.children_.begin(),
+          end = spec.children_.end();
+      for (; it != end; ++it)
+      {
+        if (likely(append))
+        {
+          if (unlikely(state->listener_ != NULL))
+            state->listener_->OnItem(*state->target_name_, var(it->target_));
+          else
+            state->var_builder_->AppendToList(var(it->target_));
+        }
+        ClearItem(*it);
+      }
     }
 
-  protected:
-    PathNode(size_t element_id)
-      : parent_(NULL)
-      , element_id_(element_id)
-      , absolute_counter_(0)
-      , relative_counter_(0)
-      , path_(element_id)
-      , filled_from_mask_target_items_(false)
-    {}
-
-    PathNode(PathNode * parent, size_t element_id)
-      : parent_(parent)
-      , element_id_(element_id)
-      , absolute_counter_(0)
-      , relative_counter_(0)
-      , path_(parent->path_ / element_id)
-      , filled_from_mask_target_items_(false)
-    {}
-
   private:
-    PathNode<T> * parent_;
-    size_t element_id_;
-    std::vector<Ptr> children_;
-    size_t absolute_counter_;
-    size_t relative_counter_;
-    Path path_;
-    bool filled_from_mask_target_items_;
-    TargetItemVector target_items_;
+    Xml2VarPlan::Ptr plan_;
+    std::vector<VarBuilderPtr> var_builders_;
+    std::vector<TargetState> targets_;
+    std::vector<ItemState> items_;
+    // values of attributes of current element by slots of program
+    std::vector<const char *> attribute_values_;
+    // name of closed element for ELEMENT_KEY
+    std::string element_key_;
+    bool first_node_;
+    // nodes of current path (NO_INDEX for elements, which are outside
+    // of tree, but can be matched by mask paths)
+    Indexes nodes_;
+    // mask DFA states of current path
+    Indexes mask_states_;
   };
 
   //----------------------------------------------------------------------------
@@ -1076,496 +1419,119 @@ namespace nkit
   {
   private:
     friend class ExpatParser<StructXml2VarBuilder<T> > ;
-    typedef typename TargetItem<T>::Ptr TargetItemPtr;
-    typedef typename Target<T>::Ptr TargetPtr;
-    typedef typename PathNode<T>::Ptr PathNodePtr;
-    typedef typename TargetItem<T>::Vector TargetItemVector;
-    typedef typename TargetItemVector::iterator TargetItemVectorIterator;
-    typedef std::map<std::string, TargetPtr> RootTargets;
 
   public:
     typedef NKIT_SHARED_PTR(StructXml2VarBuilder<T>) Ptr;
 
   public:
-    static Ptr Create(const std::string & options, std::string * error)
+    static Ptr Create(const Xml2VarPlan::Ptr & plan)
     {
-      detail::Options::Ptr o = detail::Options::Create(options, error);
-      if (!o)
-        return Ptr();
-      return Ptr(new StructXml2VarBuilder<T>(o));
+      return Ptr(new StructXml2VarBuilder<T>(plan));
     }
 
     static Ptr Create(const std::string & options,
         const std::string & mappings, std::string * error)
     {
-      detail::Options::Ptr o = detail::Options::Create(options, error);
-      if (!o)
+      Xml2VarPlan::Ptr plan = Xml2VarPlan::Create(options, mappings, error);
+      if (!plan)
         return Ptr();
-      Dynamic m = DynamicFromJson(mappings, error);
-      if (!m)
-        return Ptr();
-
-      Ptr ret(new StructXml2VarBuilder<T>(o));
-
-      DDICT_FOREACH(pair, m)
-      {
-        if (!ret->AddMapping(pair->first, pair->second, error))
-          return Ptr();
-      }
-
-      return ret;
+      return Create(plan);
     }
 
-    static Ptr Create(const Dynamic & options, std::string * error)
+    static Ptr Create(const Dynamic & options, const Dynamic & mappings,
+        std::string * error)
     {
-      detail::Options::Ptr o = detail::Options::Create(options, error);
-      if (!o)
+      Xml2VarPlan::Ptr plan = Xml2VarPlan::Create(options, mappings, error);
+      if (!plan)
         return Ptr();
-      return Ptr(new StructXml2VarBuilder<T>(o));
+      return Create(plan);
     }
 
-    bool AddMapping(const std::string & target_name,
-        const std::string & mapping, std::string * error)
+    ~StructXml2VarBuilder() {}
+
+    const Xml2VarPlan::Ptr & plan() const { return run_.plan(); }
+
+    // Drops all constructed data, so builder can be reused for the next
+    // document. Call Restart() to reset parser as well.
+    void Clear()
     {
-      Dynamic m = DynamicFromJson(mapping, error);
-      if (!m)
-        return false;
-      return AddMapping(target_name, m, error);
+      error_.clear();
+      run_.Clear();
     }
 
-    bool AddMapping(const std::string & target_name,
-        const Dynamic & mapping, std::string * error)
+    // Items of list mapping 'target_name' will be passed to listener
+    // instead of accumulating them in the list
+    bool SetItemListener(const std::string & target_name,
+        ItemListener<T> * listener, std::string * error)
     {
-      String2IdMap str2id;
-      TargetItemVector mask_target_items;
-      PathNodePtr path_tree(PathNode<T>::CreateRoot());
-
-      TargetPtr root_target = ParseMapping(mapping, options_, path_tree_,
-          &mask_target_items_, &str2id_, error);
-      if (!root_target)
-        return false;
-      root_targets_[target_name] = root_target;
-      return true;
+      return run_.SetItemListener(target_name, listener, error);
     }
 
-    ~StructXml2VarBuilder() {}
-
     StringList mapping_names() const
     {
-      StringList ret;
-      typename RootTargets::const_iterator it = root_targets_.begin(),
-          end = root_targets_.end();
-      for (; it != end; ++it)
-        ret.push_back(it->first);
-      return ret;
+      return run_.plan()->mapping_names();
     }
 
     const typename T::type & var(const std::string & target_name) const
     {
-      typename RootTargets::const_iterator
-        found = root_targets_.find(target_name),
-        not_found = root_targets_.end();
-      if (unlikely(found == not_found))
-        return T::GetUndefined();
-      else
-        return found->second->var();
+      return run_.var(target_name);
     }
 
   private:
-    StructXml2VarBuilder(detail::Options::Ptr o)
-      : path_tree_(PathNode<T>::CreateRoot())
-      , current_node_(path_tree_.get())
-      , options_(o)
-      , root_targets_()
-      , first_node_(true)
-      , str2id_()
-      , mask_target_items_()
+    StructXml2VarBuilder(const Xml2VarPlan::Ptr & plan)
+      : ExpatParser<StructXml2VarBuilder<T> >(plan->options().namespaces_)
+      , run_(plan)
     {}
 
     bool OnStartElement(const char * el, const char ** attrs)
     {
-      size_t element_id = str2id_.GetId(el);
-
-      if (first_node_)
-      {
-        first_node_ = false;
+      if (unlikely(this->finished()))
         return true;
-      }
-
-      current_path_ /= element_id;
-      PathNode<T>::MoveToChild(&current_node_, element_id);
 
-      if (!mask_target_items_.empty())
-      {
-        TargetItemVectorIterator it = mask_target_items_.begin(),
-            end = mask_target_items_.end();
-        for (; it != end; ++it)
-        {
-          TargetItemPtr mask_target_item = (*it);
-          if (mask_target_item->fool_path() == current_path_)
-            mask_target_item->OnEnter(attrs);
-        }
-      }
-
-      current_node_->OnEnter(attrs);
+      // Elements, which are not mapped by any target, are skipped by Expat
+      // with all their descendants
+      if (!run_.Enter(el, attrs))
+        this->SkipSubtree();
       return true;
     }
 
     bool OnEndElement(const char * el)
     {
-      if (!mask_target_items_.empty())
-      {
-        TargetItemVectorIterator it = mask_target_items_.begin(),
-            end = mask_target_items_.end();
-        for (; it != end; ++it)
-        {
-          TargetItemPtr mask_target_item = (*it);
-          if (mask_target_item->fool_path() == current_path_)
-            mask_target_item->OnExit(el);
-        }
-      }
+      if (unlikely(this->finished()))
+        return true;
+
+      run_.Exit(el);
 
-      current_node_->OnExit(el);
-      current_path_.BubbleUp();
-      PathNode<T>::MoveToParent(&current_node_);
+      if (unlikely(run_.plan()->options().stop_when_completed_) &&
+          run_.completed())
+        this->Finish();
       return true;
     }
 
     bool OnText(const char * text, int len)
     {
-      current_node_->OnText(text, static_cast<size_t>(len));
-
-      if (!mask_target_items_.empty())
-      {
-        TargetItemVectorIterator it = mask_target_items_.begin(),
-            end = mask_target_items_.end();
-        for (; it != end; ++it)
-        {
-          TargetItemPtr mask_target_item = (*it);
-          if (mask_target_item->fool_path() == current_path_)
-            mask_target_item->OnText(text, static_cast<size_t>(len));
-        }
-      }
+      if (unlikely(this->finished()))
+        return true;
 
+      run_.Text(text, static_cast<size_t>(len), this->InBuffer(text));
       return true;
     }
 
-    void GetCustomError(std::string * error)
+    void OnChunkParsed()
     {
-      *error = error_;
+      run_.Detach();
+      run_.Persist();
     }
 
-    //--------------------------------------------------------------------------
-    static TargetItemPtr ParseScalarTargetSpec(
-        Target<T> * parent_target,
-        Path parent_path,
-        const std::string & mapping,
-        const detail::Options::Ptr & options,
-        PathNodePtr path_tree,
-        TargetItemVector * mask_target_items,
-        std::string * error)
-    {
-      static const std::string STRING_TYPE = "string";
-      static const std::string INTEGER_TYPE = "integer";
-      static const std::string NUMBER_TYPE = "number";
-      static const std::string DATETIME_TYPE = "datetime";
-      static const std::string BOOLEAN_TYPE = "boolean";
-
-      StringVector spec_list;
-      simple_split(mapping, "|", &spec_list);
-      if (spec_list.size() < 1)
-      {
-        *error = "Type definition for scalar must be of following format:\n"
-            "- integer|optional_integer_default\n"
-            "- number|optional_number_default\n"
-            "- string|optional_string_default\n"
-            "- boolean|optional_boolean_default\n"
-            "- datetime|mandatory_default_dateTime_value"
-                "|mandatory_formatting_string";
-        return TargetItemPtr();
-      }
-
-      TargetPtr target;
-      const std::string & type = spec_list[0];
-      if (type == STRING_TYPE)
-      {
-        typedef ScalarTarget<T,
-            &T::InitAsString,
-            &T::InitAsStringFormat> StringTarget;
-        if (spec_list.size() >= 2)
-          target = StringTarget::Create(options, spec_list[1]);
-        else
-          target = StringTarget::Create(options);
-      }
-      else if (type == INTEGER_TYPE)
-      {
-        typedef ScalarTarget<T,
-            &T::InitAsInteger,
-            &T::InitAsIntegerFormat> IntegerTarget;
-        if (spec_list.size() >= 2)
-          target = IntegerTarget::Create(options, spec_list[1]);
-        else
-          target = IntegerTarget::Create(options);
-      }
-      else if (type == NUMBER_TYPE)
-      {
-        typedef ScalarTarget<T,
-            &T::InitAsFloat,
-            &T::InitAsFloatFormat> NumberTarget;
-        if (spec_list.size() >= 3)
-          target = NumberTarget::Create(options, spec_list[1], spec_list[2]);
-        else if (spec_list.size() >= 2)
-          target = NumberTarget::Create(options, spec_list[1]);
-        else
-          target = NumberTarget::Create(options);
-      }
-      else if (type == BOOLEAN_TYPE)
-      {
-        typedef ScalarTarget<T,
-            &T::InitAsBoolean,
-            &T::InitAsBooleanFormat> BooleanTarget;
-        if (spec_list.size() >= 2)
-        {
-          std::string boolean_default(spec_list[1]);
-          if (options->use_custom_bool_variants_
-              && (options->true_variants_.find(boolean_default) ==
-                      options->true_variants_.end())
-              && (options->false_variants_.find(boolean_default) ==
-                      options->false_variants_.end())
-              )
-          {
-            *error = "Default value for boolean must one of those, defined in "
-                "'true_variants' or 'false_variants' options, but '" +
-                boolean_default + "' has been provided.\nPossible values:" +
-                "\n- true_variants: " +
-                join(options->true_variants_, ", ", "", "") +
-                "\n- false_variants: " +
-                join(options->false_variants_, ", ", "", "");
-            return TargetItemPtr();
-          }
-
-          target = BooleanTarget::Create(options, boolean_default);
-        }
-        else
-          target = BooleanTarget::Create(options);
-      }
-      else if (type == DATETIME_TYPE)
-      {
-        typedef ScalarTarget<T,
-            &T::InitAsDatetime,
-            &T::InitAsDatetimeFormat> DatetimeTarget;
-        if (spec_list.size() >= 3)
-          target = DatetimeTarget::Create(options, spec_list[1], spec_list[2]);
-        else if (spec_list.size() >= 2)
-          target = DatetimeTarget::Create(options, spec_list[1]);
-        else
-          target = DatetimeTarget::Create(options);
-      }
-      else
-      {
-        *error = "Scalar does not support type '" + type + "'";
-        return TargetItemPtr();
-      }
-
-      TargetItemPtr target_item = TargetItem<T>::Create(parent_path, target);
-      target_item->SetParentTarget(parent_target);
-
-      if (parent_path.is_mask())
-        mask_target_items->push_back(target_item);
-      else
-        path_tree->PutTargetItem(target_item);
-
-      return target_item;
-    }
-
-    //--------------------------------------------------------------------------
-    static TargetItemPtr ParseListTargetSpec(
-        Target<T> * parent_target,
-        Path parent_path,
-        const Dynamic & mapping,
-        const detail::Options::Ptr & options,
-        PathNodePtr path_tree,
-        TargetItemVector * mask_target_items,
-        String2IdMap * str2id,
-        std::string * error)
-    {
-      size_t count = mapping.size();
-      if (count != 2)
-      {
-        *error = "List mapping must have two elements: "
-          "path/to/xml/element/with/data and sub-mapping";
-        return TargetItemPtr();
-      }
-
-      typename ListTarget<T>::Ptr target =
-          ListTarget<T>::Create(options);
-
-      Path path(mapping.GetByIndex(0).GetString(), str2id);
-      const Dynamic & sum_mapping = mapping.GetByIndex(1);
-
-      Path fool_path(parent_path / path);
-
-      TargetItemPtr child_target_item =
-          ParseTargetSpec(target.get(), fool_path, sum_mapping,
-              options, path_tree, mask_target_items, str2id, error);
-      if (!child_target_item)
-        return TargetItemPtr();
-
-        target->PutTargetItem(child_target_item);
-
-      TargetItemPtr target_item = TargetItem<T>::Create(fool_path,
-          target);
-      target_item->SetParentTarget(parent_target);
-
-      if (fool_path.is_mask())
-        mask_target_items->push_back(target_item);
-      else
-        path_tree->PutTargetItem(target_item);
-
-      return target_item;
-    }
-
-    //--------------------------------------------------------------------------
-    static TargetItemPtr ParseObjectTargetSpec(
-        Target<T> * parent_target,
-        Path parent_path,
-        const Dynamic & mapping,
-        const detail::Options::Ptr & options,
-        PathNodePtr path_tree,
-        TargetItemVector * mask_target_items,
-        String2IdMap * str2id,
-        std::string * error)
-    {
-      typename ObjectTarget<T>::Ptr target =
-          ObjectTarget<T>::Create(options);
-
-      DDICT_FOREACH(pair, mapping)
-      {
-        std::string path_spec, key;
-        simple_split(pair->first, "->", &path_spec, &key);
-        Path path(path_spec, str2id);
-        bool key_is_attribute = false;
-        if (key.empty())
-        {
-          if (!path.attribute_name().empty())
-          {
-            key = path.attribute_name();
-            if (key == S_STAR_)
-            {
-              *error = "Attribute name should not be '*'";
-              return TargetItemPtr();
-            }
-          }
-          else
-            key = path.GetLastElementName(*str2id);
-        }
-        else if (starts_with(key, "@"))
-        {
-          key_is_attribute = true;
-          key.erase(0, 1);
-          if (key.empty())
-          {
-            *error = "Key alias should not be '@'";
-            return TargetItemPtr();
-          }
-        }
-
-        Path fool_path(parent_path / path);
-        TargetItemPtr child_target_item = ParseTargetSpec(target.get(),
-            fool_path, pair->second, options, path_tree, mask_target_items,
-            str2id, error);
-        if (!child_target_item)
-          return TargetItemPtr();
-
-        child_target_item->SetKey(key, key_is_attribute);
-
-        target->PutTargetItem(child_target_item);
-      }
-
-      TargetItemPtr target_item =
-          TargetItem<T>::Create(parent_path, target);
-      target_item->SetParentTarget(parent_target);
-
-      if (parent_path.is_mask())
-        mask_target_items->push_back(target_item);
-      else
-        path_tree->PutTargetItem(target_item);
-
-      return target_item;
-    }
-
-    //--------------------------------------------------------------------------
-    static TargetItemPtr ParseTargetSpec(
-        Target<T> * parent_target,
-        Path parent_path,
-        const Dynamic & mapping,
-        const detail::Options::Ptr & options,
-        PathNodePtr path_tree,
-        TargetItemVector * mask_target_items,
-        String2IdMap * str2id,
-        std::string * error)
-    {
-      TargetItemPtr target_item;
-      if (mapping.IsList())
-        target_item = ParseListTargetSpec(parent_target, parent_path,
-          mapping, options, path_tree, mask_target_items, str2id, error);
-      else if (mapping.IsDict())
-        target_item = ParseObjectTargetSpec(parent_target, parent_path,
-          mapping, options, path_tree, mask_target_items, str2id, error);
-      else if (mapping.IsString())
-        target_item = ParseScalarTargetSpec(parent_target, parent_path,
-          mapping.GetConstString(), options, path_tree, mask_target_items, error);
-      else
-      {
-        *error = "Child mapping can be dictionary (object), list or string";
-        return TargetItemPtr();
-      }
-
-      return target_item;
-    }
-
-    //--------------------------------------------------------------------------
-    static TargetPtr ParseMapping(
-        const Dynamic & mapping,
-        const detail::Options::Ptr & options,
-        PathNodePtr path_tree,
-        TargetItemVector * mask_target_items,
-        String2IdMap * str2id,
-        std::string * error)
+    void GetCustomError(std::string * error)
     {
-      Path empty_path;
-
-      TargetItemPtr target_item;
-      if (mapping.IsList())
-        target_item = ParseListTargetSpec(NULL, empty_path, mapping,
-            options, path_tree, mask_target_items, str2id, error);
-      else if (mapping.IsDict())
-        target_item = ParseObjectTargetSpec(NULL, empty_path, mapping,
-            options, path_tree, mask_target_items, str2id, error);
-      else
-      {
-        *error =
-            "Root mapping can not be scalar - only dictionary (object) or list";
-        return TargetPtr();
-      }
-
-      if (!target_item)
-        return TargetPtr();
-
-      return target_item->target();
+      *error = error_;
     }
 
   //----------------------------------------------------------------------------
   private:
     std::string error_;
-    PathNodePtr path_tree_;
-    PathNode<T> * current_node_;
-    detail::Options::Ptr options_;
-    Path current_path_;
-    RootTargets root_targets_;
-    bool first_node_;
-    String2IdMap str2id_;
-    TargetItemVector mask_target_items_;
+    Xml2VarRun<T> run_;
   }; // StructXml2VarBuilder
 
   //----------------------------------------------------------------------------
@@ -1596,10 +1562,9 @@ namespace nkit
       return Ptr(new AnyXml2VarBuilder<T>(o));
     }
 
-    ~AnyXml2VarBuilder()
-    {
-      Clear();
-    }
+    // Clear() must not be called here: builder can be destroyed from V8
+    // garbage collector callback, where new V8 values can't be created
+    ~AnyXml2VarBuilder() {}
 
     const typename T::type & var() const
     {
@@ -1611,12 +1576,25 @@ namespace nkit
       return root_name_;
     }
 
+    // Elements at depth of "emit_depth" option with names from
+    // 'element_names' (with any names, if it is empty) are passed to
+    // listener as soon as they are closed and are not appended to their
+    // parents, so memory usage is bounded by the size of one record.
+    // NULL listener turns it off. Listener is kept by Clear().
+    void SetItemListener(ItemListener<T> * listener,
+        const std::set<std::string> & element_names)
+    {
+      listener_ = listener;
+      emit_names_ = element_names;
+    }
+
     bool Clear(const Dynamic & options, std::string * error)
     {
       detail::Options::Ptr o = detail::Options::Create(options, error);
       if (!o)
         return false;
       options_ = o;
+      this->UseNamespaces(o->namespaces_);
       Clear();
       return true;
     }
@@ -1624,32 +1602,41 @@ namespace nkit
     void Clear()
     {
       root_var_builder_ = NewVarBuilder();
+      root_var_builder_->UseLocalHandles(false);
       first_ = true;
       root_name_.clear();
-      current_text_stack_.Reset();
       clear_stack(is_simple_element_stack_);
-      clear_stack(var_builder_stack_);
+      var_builder_stack_.clear();
       clear_stack(var_builder_cache_);
-      current_text_stack_.PushEmptyString();
+      depth_ = 0;
+      if (texts_.empty())
+        texts_.resize(1);
+      texts_[0].Clear();
       is_simple_element_stack_.push(false);
       root_var_builder_->InitAsDict();
-      var_builder_stack_.push(root_var_builder_);
+      var_builder_stack_.push_back(root_var_builder_);
       if (options_->attrkey_.empty())
         options_->attrkey_ = "$";
       if (options_->textkey_.empty())
         options_->textkey_ = "_";
+      options_->RegisterKeys();
     }
 
   private:
     AnyXml2VarBuilder(detail::Options::Ptr o)
-      : options_(o)
+      : ExpatParser<AnyXml2VarBuilder<T> >(o->namespaces_)
+      , options_(o)
       , first_(true)
+      , depth_(0)
+      , listener_(NULL)
     {
       Clear();
     }
 
     bool OnStartElement(const char * el, const char ** attrs)
     {
+      if (options_->strip_namespaces_)
+        el = local_name(el);
       bool has_attrs = (attrs[0] != NULL);
       if (unlikely(first_))
       {
@@ -1663,49 +1650,86 @@ namespace nkit
       {
         is_simple_element_stack_.top() = false;
         VarBuilderPtr var_builder_ = NewVarBuilder();
+        var_builder_->UseLocalHandles(true);
         var_builder_->InitAsDict();
         if (has_attrs)
           var_builder_->SetAttrKey(attrs);
         is_simple_element_stack_.push(!has_attrs);
-        var_builder_stack_.push(var_builder_);
-        current_text_stack_.PushEmptyString();
+        var_builder_stack_.push_back(var_builder_);
+        if (++depth_ == texts_.size())
+          texts_.resize(depth_ + 1);
+        texts_[depth_].Clear();
       }
       return true;
     }
 
     bool OnEndElement(const char * el)
     {
+      if (options_->strip_namespaces_)
+        el = local_name(el);
+      TextSlice & current_text = texts_[depth_];
       if (options_->trim_)
-        current_text_stack_.TrimTopString(options_->white_spaces_);
+        current_text.Trim(options_->white_space_table_);
 
-      const std::string & current_text = current_text_stack_.top();
-
-      if (is_simple_element_stack_.top())
+      if (unlikely(listener_ != NULL && depth_ == options_->emit_depth_)
+          && (emit_names_.empty() || emit_names_.count(el) != 0))
+        EmitElement(el, current_text);
+      else if (is_simple_element_stack_.top())
       {
         PopVarBuilderStack();
-        var_builder_stack_.top()->AppendToDictKeyList(el, current_text);
+        var_builder_stack_.back()->AppendToDictKeyList(std::string(el),
+            current_text.data(), current_text.size());
       }
       else
       {
-        VarBuilderPtr last = var_builder_stack_.top();
+        VarBuilderPtr last = var_builder_stack_.back();
         if (!current_text.empty())
-          last->SetDictKeyValue(options_->textkey_, current_text);
+          last->SetDictKeyValue(options_->textkey(), current_text.data(),
+              current_text.size());
         PopVarBuilderStack();
         if (!var_builder_stack_.empty())
-          var_builder_stack_.top()->AppendToDictKeyList(el, (*last).get());
+          var_builder_stack_.back()->AppendToDictKeyList(std::string(el),
+              *last);
       }
 
       is_simple_element_stack_.pop();
-      current_text_stack_.Pop();
+      current_text.Clear();
+      if (depth_ > 0)
+        --depth_;
       return true;
     }
 
     bool OnText(const char * text, int len)
     {
-      current_text_stack_.AppendToTopString(text, len);
+      texts_[depth_].Append(text, static_cast<size_t>(len),
+          this->InBuffer(text));
       return true;
     }
 
+    void EmitElement(const char * el, const TextSlice & text)
+    {
+      VarBuilderPtr last = var_builder_stack_.back();
+      if (is_simple_element_stack_.top())
+        last->InitAsString(text.data(), text.size());
+      else if (!text.empty())
+        last->SetDictKeyValue(options_->textkey(), text.data(), text.size());
+      last->Persist();
+      item_name_.assign(el);
+      listener_->OnItem(item_name_, last->get());
+      PopVarBuilderStack();
+    }
+
+    // Values of elements may be kept in short-lived storage during parsing
+    // of chunk (see VarBuilder::UseLocalHandles()): only open elements
+    // are persisted
+    void OnChunkParsed()
+    {
+      for (size_t i = 0; i <= depth_ && i < texts_.size(); ++i)
+        texts_[i].Detach();
+      for (size_t i = 1; i < var_builder_stack_.size(); ++i)
+        var_builder_stack_[i]->Persist();
+    }
+
     void GetCustomError(std::string * error)
     {
       *error = error_;
@@ -1723,80 +1747,27 @@ namespace nkit
 
     void PopVarBuilderStack()
     {
-      VarBuilderPtr top = var_builder_stack_.top();
-      var_builder_stack_.pop();
+      VarBuilderPtr top = var_builder_stack_.back();
+      var_builder_stack_.pop_back();
       var_builder_cache_.push(top);
     }
 
   //----------------------------------------------------------------------------
-  private:
-    class StringStack: Uncopyable
-    {
-    public:
-      void Reset()
-      {
-        clear_stack(stack_);
-        clear_stack(cache_);
-      }
-
-      void PushEmptyString()
-      {
-        if (cache_.empty())
-        {
-          top_ = Dynamic(S_EMPTY_);
-        }
-        else
-        {
-          top_ = cache_.top();
-          top_.Clear();
-          cache_.pop();
-        }
-
-        stack_.push(top_);
-      }
-
-      void Pop()
-      {
-        cache_.push(top_);
-
-        assert(!stack_.empty());
-        stack_.pop();
-
-        if (!stack_.empty())
-          top_ = stack_.top();
-      }
-
-      void AppendToTopString(const char * str, size_t len)
-      {
-        top_.Append(str, len);
-      }
-
-      void TrimTopString(const std::string & white_spaces)
-      {
-        top_.Trim(white_spaces);
-      }
-
-      const std::string & top() const
-      {
-        return top_.GetConstString();
-      }
-
-    private:
-      Dynamic top_;
-      std::stack<Dynamic> stack_;
-      std::stack<Dynamic> cache_;
-    };
-  //----------------------------------------------------------------------------
   private:
     std::string error_;
     detail::Options::Ptr options_;
     VarBuilderPtr root_var_builder_;
     bool first_;
     std::string root_name_;
-    std::stack<VarBuilderPtr> var_builder_stack_;
+    std::vector<VarBuilderPtr> var_builder_stack_;
     std::stack<VarBuilderPtr> var_builder_cache_;
     std::stack<bool> is_simple_element_stack_;
-    StringStack current_text_stack_;
+    // texts of open elements by depth (slices are reused)
+    std::vector<TextSlice> texts_;
+    size_t depth_;
+    ItemListener<T> * listener_;
+    std::set<std::string> emit_names_;
+    std::string item_name_;
   }; // AnyXml2VarBuilder
 
 } // namespace nkit
@@ -14,6 +14,7 @@
    limitations under the License.
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
@@ -311,6 +312,155 @@ namespace nkit
     return std::string(tmp);
   }
 
+  //----------------------------------------------------------------------------
+  static inline bool is_c_space(char ch)
+  {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+  }
+
+  static inline bool is_digit(char ch)
+  {
+    return ch >= '0' && ch <= '9';
+  }
+
+  //----------------------------------------------------------------------------
+  bool parse_int64(const char * str, size_t size, int64_t * out)
+  {
+    const char * c = str, * end = str + size;
+    while (c != end && is_c_space(*c))
+      ++c;
+
+    bool negative = false;
+    if (c != end && (*c == '-' || *c == '+'))
+      negative = (*c++ == '-');
+
+    if (c == end || !is_digit(*c))
+      return false;
+
+    // accumulate as negative number, so INT64_MIN fits
+    static const int64_t MIN = std::numeric_limits<int64_t>::min();
+    int64_t value = 0;
+    bool overflow = false;
+    for (; c != end && is_digit(*c); ++c)
+    {
+      int digit = *c - '0';
+      if (value < (MIN + digit) / 10)
+        overflow = true;
+      else
+        value = value * 10 - digit;
+    }
+
+    if (overflow)
+      *out = negative ? MIN : std::numeric_limits<int64_t>::max();
+    else if (negative)
+      *out = value;
+    else if (value == MIN)
+      *out = std::numeric_limits<int64_t>::max();
+    else
+      *out = -value;
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  // Mantissa up to 2^53 and power of ten up to 22 are exact doubles,
+  // so one multiplication or division gives correctly rounded result.
+  // Other numbers are passed to strtod().
+  static const double EXACT_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  static const int MAX_EXACT_POWER_OF_TEN = 22;
+  static const uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 53;
+
+  bool parse_double(const char * str, size_t size, double * out)
+  {
+    const char * c = str, * end = str + size;
+    while (c != end && is_c_space(*c))
+      ++c;
+    const char * begin = c;
+
+    bool negative = false;
+    if (c != end && (*c == '-' || *c == '+'))
+      negative = (*c++ == '-');
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    size_t digits = 0;
+    bool inexact = false;
+
+    // hexadecimal numbers, 'inf' and 'nan' are left to strtod()
+    bool fallback = (c != end && *c == '0' && c + 1 != end
+        && (c[1] == 'x' || c[1] == 'X'));
+
+    for (; !fallback && c != end && is_digit(*c); ++c, ++digits)
+    {
+      if (mantissa < MAX_EXACT_MANTISSA)
+        mantissa = mantissa * 10 + (*c - '0');
+      else
+      {
+        ++exponent;
+        inexact = inexact || *c != '0';
+      }
+    }
+
+    if (!fallback && c != end && *c == '.')
+    {
+      for (++c; c != end && is_digit(*c); ++c, ++digits)
+      {
+        if (mantissa < MAX_EXACT_MANTISSA)
+        {
+          mantissa = mantissa * 10 + (*c - '0');
+          --exponent;
+        }
+        else
+          inexact = inexact || *c != '0';
+      }
+    }
+
+    if (digits == 0)
+      fallback = true;
+    else if (c != end && (*c == 'e' || *c == 'E'))
+    {
+      const char * e = c + 1;
+      bool negative_exponent = false;
+      if (e != end && (*e == '-' || *e == '+'))
+        negative_exponent = (*e++ == '-');
+      if (e != end && is_digit(*e))
+      {
+        int exp_value = 0;
+        for (; e != end && is_digit(*e); ++e)
+        {
+          if (exp_value < 100000)
+            exp_value = exp_value * 10 + (*e - '0');
+        }
+        exponent += negative_exponent ? -exp_value : exp_value;
+        c = e;
+      }
+    }
+
+    if (!fallback && !inexact && mantissa <= MAX_EXACT_MANTISSA
+        && exponent >= -MAX_EXACT_POWER_OF_TEN
+        && exponent <= MAX_EXACT_POWER_OF_TEN)
+    {
+      double value = static_cast<double>(mantissa);
+      if (exponent < 0)
+        value /= EXACT_POWERS_OF_TEN[-exponent];
+      else
+        value *= EXACT_POWERS_OF_TEN[exponent];
+      *out = negative ? -value : value;
+      return true;
+    }
+
+    // strtod() needs zero terminated string
+    std::string tmp(begin, fallback ? end : c);
+    char * tail = NULL;
+    double value = strtod(tmp.c_str(), &tail);
+    if (tail == tmp.c_str())
+      return false;
+    *out = value;
+    return true;
+  }
+
   //----------------------------------------------------------------------------
   bool is_hex_lower(const std::string & str)
   {
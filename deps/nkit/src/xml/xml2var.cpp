@@ -1,5 +1,6 @@
 #include "nkit/xml2var.h"
 #include "nkit/var2xml.h"
+#include "nkit/mutex.h"
 
 namespace nkit
 {
@@ -9,6 +10,23 @@ namespace nkit
     const bool Options::UNICODE_DEFAULT = true;
     const bool Options::ORDERED_DICT = false;
     const bool Options::EXPLICIT_ARRAY_DEFAULT = true;
+    const bool Options::INT64_DEFAULT = false;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t DictKey::Register(const std::string & name)
+  {
+    typedef std::map<std::string, size_t> Ids;
+    static Mutex mutex;
+    static Ids ids;
+
+    LockGuard<Mutex> lock(mutex);
+    Ids::const_iterator found = ids.find(name);
+    if (found != ids.end())
+      return found->second;
+    size_t id = ids.size();
+    ids[name] = id;
+    return id;
   }
 
   const size_t Var2XmlOptions::DEFAULT_FLOAT_PRECISION = 2;
@@ -45,4 +63,611 @@ namespace nkit
     return NULL;
   }
 
+  //----------------------------------------------------------------------------
+  const size_t Xml2VarPlan::NO_INDEX = static_cast<size_t>(-1);
+
+  //----------------------------------------------------------------------------
+  Xml2VarPlan::Ptr Xml2VarPlan::Create(const std::string & options,
+      const std::string & mappings, std::string * error)
+  {
+    detail::Options::Ptr o = detail::Options::Create(options, error);
+    if (!o)
+      return Ptr();
+    Dynamic m = DynamicFromJson(mappings, error);
+    if (!m)
+      return Ptr();
+    return Create(o, m, error);
+  }
+
+  Xml2VarPlan::Ptr Xml2VarPlan::Create(const Dynamic & options,
+      const Dynamic & mappings, std::string * error)
+  {
+    detail::Options::Ptr o = detail::Options::Create(options, error);
+    if (!o)
+      return Ptr();
+    return Create(o, mappings, error);
+  }
+
+  Xml2VarPlan::Ptr Xml2VarPlan::Create(const detail::Options::Ptr & options,
+      const Dynamic & mappings, std::string * error)
+  {
+    if (!mappings.IsDict())
+    {
+      *error = "Mappings must be dictionary (object)";
+      return Ptr();
+    }
+
+    Ptr ret(new Xml2VarPlan(options));
+    DDICT_FOREACH(pair, mappings)
+    {
+      if (!ret->AddMapping(pair->first, pair->second, error))
+        return Ptr();
+    }
+
+    // misspelled name would silently disable early termination
+    std::map<std::string, size_t>::const_iterator limit =
+        options->limits_.begin(), limits_end = options->limits_.end();
+    for (; limit != limits_end; ++limit)
+    {
+      if (ret->root_targets_.find(limit->first) == ret->root_targets_.end())
+      {
+        *error = "Unknown mapping name: '" + limit->first + "'";
+        return Ptr();
+      }
+    }
+
+    ret->CompileMasks();
+    ret->CompilePrograms();
+    return ret;
+  }
+
+  Xml2VarPlan::Xml2VarPlan(const detail::Options::Ptr & options)
+    : options_(options)
+    , other_element_id_(0)
+    , nodes_(1)
+    , max_attributes_(0)
+  {
+    nodes_[0].element_id_ = String2IdMap::STAR_ID;
+    nodes_[0].has_items_below_ = false;
+  }
+
+  StringList Xml2VarPlan::mapping_names() const
+  {
+    StringList ret;
+    RootTargets::const_iterator it = root_targets_.begin(),
+        end = root_targets_.end();
+    for (; it != end; ++it)
+      ret.push_back(it->first);
+    return ret;
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarPlan::CheckListMapping(const std::string & target_name,
+      std::string * error) const
+  {
+    RootTargets::const_iterator found = root_targets_.find(target_name);
+    if (found == root_targets_.end())
+    {
+      *error = "Unknown mapping name: '" + target_name + "'";
+      return false;
+    }
+
+    if (targets_[found->second].type_ != LIST_TARGET)
+    {
+      *error = "Mapping '" + target_name + "' is not a list";
+      return false;
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarPlan::AddMapping(const std::string & target_name,
+      const Dynamic & mapping, std::string * error)
+  {
+    Path empty_path;
+    size_t item = NO_INDEX;
+    if (mapping.IsList())
+      item = ParseListTargetSpec(NO_INDEX, empty_path, mapping, error);
+    else if (mapping.IsDict())
+      item = ParseObjectTargetSpec(NO_INDEX, empty_path, mapping, error);
+    else
+    {
+      *error =
+          "Root mapping can not be scalar - only dictionary (object) or list";
+      return false;
+    }
+
+    if (item == NO_INDEX)
+      return false;
+
+    size_t target = items_[item].target_;
+    std::map<std::string, size_t>::const_iterator limit =
+        options_->limits_.find(target_name);
+    if (limit != options_->limits_.end())
+    {
+      if (targets_[target].type_ != LIST_TARGET)
+      {
+        *error = "Mapping '" + target_name + "' is not a list, so it can't"
+            " be limited";
+        return false;
+      }
+      targets_[target].limit_ = limit->second;
+    }
+
+    root_targets_[target_name] = target;
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t Xml2VarPlan::ParseTargetSpec(size_t parent_target, Path parent_path,
+      const Dynamic & mapping, std::string * error)
+  {
+    if (mapping.IsList())
+      return ParseListTargetSpec(parent_target, parent_path, mapping, error);
+    else if (mapping.IsDict())
+      return ParseObjectTargetSpec(parent_target, parent_path, mapping, error);
+    else if (mapping.IsString())
+      return ParseScalarTargetSpec(parent_target, parent_path,
+          mapping.GetConstString(), error);
+
+    *error = "Child mapping can be dictionary (object), list or string";
+    return NO_INDEX;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t Xml2VarPlan::ParseScalarTargetSpec(size_t parent_target,
+      Path parent_path, const std::string & mapping, std::string * error)
+  {
+    static const std::string STRING_TYPE = "string";
+    static const std::string INTEGER_TYPE = "integer";
+    static const std::string NUMBER_TYPE = "number";
+    static const std::string DATETIME_TYPE = "datetime";
+    static const std::string BOOLEAN_TYPE = "boolean";
+
+    StringVector spec_list;
+    simple_split(mapping, "|", &spec_list);
+    if (spec_list.size() < 1)
+    {
+      *error = "Type definition for scalar must be of following format:\n"
+          "- integer|optional_integer_default\n"
+          "- number|optional_number_default\n"
+          "- string|optional_string_default\n"
+          "- boolean|optional_boolean_default\n"
+          "- datetime|mandatory_default_dateTime_value"
+              "|mandatory_formatting_string";
+      return NO_INDEX;
+    }
+
+    ScalarType scalar_type;
+    const std::string & type = spec_list[0];
+    if (type == STRING_TYPE)
+      scalar_type = STRING_SCALAR;
+    else if (type == INTEGER_TYPE)
+      scalar_type = INTEGER_SCALAR;
+    else if (type == NUMBER_TYPE)
+      scalar_type = NUMBER_SCALAR;
+    else if (type == BOOLEAN_TYPE)
+      scalar_type = BOOLEAN_SCALAR;
+    else if (type == DATETIME_TYPE)
+      scalar_type = DATETIME_SCALAR;
+    else
+    {
+      *error = "Scalar does not support type '" + type + "'";
+      return NO_INDEX;
+    }
+
+    if (scalar_type == BOOLEAN_SCALAR && spec_list.size() >= 2)
+    {
+      const std::string & boolean_default = spec_list[1];
+      if (options_->use_custom_bool_variants_
+          && (options_->true_variants_.find(boolean_default) ==
+                  options_->true_variants_.end())
+          && (options_->false_variants_.find(boolean_default) ==
+                  options_->false_variants_.end())
+          )
+      {
+        *error = "Default value for boolean must one of those, defined in "
+            "'true_variants' or 'false_variants' options, but '" +
+            boolean_default + "' has been provided.\nPossible values:" +
+            "\n- true_variants: " +
+            join(options_->true_variants_, ", ", "", "") +
+            "\n- false_variants: " +
+            join(options_->false_variants_, ", ", "", "");
+        return NO_INDEX;
+      }
+    }
+
+    size_t target = AddTarget(SCALAR_TARGET);
+    TargetSpec & spec = targets_[target];
+    spec.scalar_type_ = scalar_type;
+    if (spec_list.size() >= 2)
+    {
+      spec.has_default_value_ = true;
+      spec.default_value_ = spec_list[1];
+    }
+
+    // only numbers and datetimes have format
+    if (spec_list.size() >= 3 &&
+        (scalar_type == NUMBER_SCALAR || scalar_type == DATETIME_SCALAR))
+    {
+      spec.format_ = spec_list[2];
+      if (options_->trim_)
+        trim(spec.default_value_, options_->white_spaces_);
+    }
+
+    size_t item = AddItem(target, parent_target, parent_path);
+    PutItemToTree(item);
+    return item;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t Xml2VarPlan::ParseListTargetSpec(size_t parent_target,
+      Path parent_path, const Dynamic & mapping, std::string * error)
+  {
+    size_t count = mapping.size();
+    if (count != 2)
+    {
+      *error = "List mapping must have two elements: "
+        "path/to/xml/element/with/data and sub-mapping";
+      return NO_INDEX;
+    }
+
+    size_t target = AddTarget(LIST_TARGET);
+
+    Path path(mapping.GetByIndex(0).GetString(), &str2id_);
+    const Dynamic & sub_mapping = mapping.GetByIndex(1);
+
+    Path fool_path(parent_path / path);
+
+    size_t child_item = ParseTargetSpec(target, fool_path, sub_mapping,
+        error);
+    if (child_item == NO_INDEX)
+      return NO_INDEX;
+
+    AppendItem(child_item, &targets_[target].items_);
+
+    size_t item = AddItem(target, parent_target, fool_path);
+    PutItemToTree(item);
+    return item;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t Xml2VarPlan::ParseObjectTargetSpec(size_t parent_target,
+      Path parent_path, const Dynamic & mapping, std::string * error)
+  {
+    size_t target = AddTarget(OBJECT_TARGET);
+
+    DDICT_FOREACH(pair, mapping)
+    {
+      std::string path_spec, key;
+      simple_split(pair->first, "->", &path_spec, &key);
+      Path path(path_spec, &str2id_);
+      bool key_is_attribute = false;
+      if (key.empty())
+      {
+        if (!path.attribute_name().empty())
+        {
+          key = path.attribute_name();
+          if (key == S_STAR_)
+          {
+            *error = "Attribute name should not be '*'";
+            return NO_INDEX;
+          }
+        }
+        else
+          key = path.GetLastElementName(str2id_);
+        if (options_->strip_namespaces_)
+          key = local_name(key.c_str());
+      }
+      else if (starts_with(key, "@"))
+      {
+        key_is_attribute = true;
+        key.erase(0, 1);
+        if (key.empty())
+        {
+          *error = "Key alias should not be '@'";
+          return NO_INDEX;
+        }
+      }
+
+      size_t child_item = ParseTargetSpec(target, parent_path / path,
+          pair->second, error);
+      if (child_item == NO_INDEX)
+        return NO_INDEX;
+
+      items_[child_item].key_ = key;
+      items_[child_item].key_is_attribute_ = key_is_attribute;
+
+      AppendObjectItem(target, child_item);
+    }
+
+    // Root object is filled in place to be available before the end
+    // of document
+    if (parent_target != NO_INDEX)
+      SetFixedShape(target);
+
+    size_t item = AddItem(target, parent_target, parent_path);
+    PutItemToTree(item);
+    return item;
+  }
+
+  //----------------------------------------------------------------------------
+  size_t Xml2VarPlan::AddTarget(TargetType type)
+  {
+    targets_.push_back(TargetSpec());
+    TargetSpec & spec = targets_.back();
+    spec.type_ = type;
+    spec.scalar_type_ = STRING_SCALAR;
+    spec.has_default_value_ = false;
+    spec.limit_ = 0;
+    return targets_.size() - 1;
+  }
+
+  size_t Xml2VarPlan::AddItem(size_t target, size_t parent_target,
+      const Path & path)
+  {
+    items_.push_back(ItemSpec());
+    ItemSpec & spec = items_.back();
+    spec.target_ = target;
+    spec.parent_target_ = parent_target;
+    spec.path_ = path;
+    spec.key_is_attribute_ = false;
+    spec.deferred_ = false;
+    return items_.size() - 1;
+  }
+
+  // Keeps 'items' in order of path length
+  void Xml2VarPlan::AppendItem(size_t item, Indexes * items) const
+  {
+    size_t size = items_[item].path_.size();
+    Indexes::iterator it = items->begin(), end = items->end();
+    for (; it != end; ++it)
+    {
+      if (size < items_[*it].path_.size())
+        break;
+    }
+    items->insert(it, item);
+  }
+
+  // Keys of object must be unique: item with duplicate key is filled, but
+  // its value is not put to object
+  bool Xml2VarPlan::AppendObjectItem(size_t target, size_t item)
+  {
+    Indexes & items = targets_[target].items_;
+    Indexes::const_iterator it = items.begin(), end = items.end();
+    for (; it != end; ++it)
+    {
+      if (items_[*it].key_ == items_[item].key_)
+        return false;
+    }
+    AppendItem(item, &items);
+    return true;
+  }
+
+  // Values of items with fixed keys (which do not depend on element name
+  // or attributes) are not put to the object as soon as they are parsed,
+  // but all at once on exit of object in order of its items. So every
+  // object, built by this target, gets its keys in the same order
+  // regardless of element order and default values, i.e. has the same shape.
+  void Xml2VarPlan::SetFixedShape(size_t target)
+  {
+    const Indexes & items = targets_[target].items_;
+    Indexes::const_iterator it = items.begin(), end = items.end();
+    for (; it != end; ++it)
+    {
+      ItemSpec & spec = items_[*it];
+      if (!spec.key_.empty() && !spec.key_is_attribute_ &&
+          spec.key_ != S_STAR_)
+        spec.deferred_ = true;
+    }
+  }
+
+  // Items with mask paths are matched by mask DFA, other ones - by tree
+  void Xml2VarPlan::PutItemToTree(size_t item)
+  {
+    const Path & path = items_[item].path_;
+    if (path.is_mask())
+    {
+      mask_items_.push_back(item);
+      return;
+    }
+
+    size_t node = 0;
+    std::vector<size_t>::const_iterator element_id = path.elements().begin(),
+        end = path.elements().end();
+    for (; element_id != end; ++element_id)
+    {
+      size_t child = GetChild(node, *element_id);
+      if (child == NO_INDEX)
+      {
+        child = nodes_.size();
+        nodes_.push_back(Node());
+        nodes_.back().element_id_ = *element_id;
+        nodes_[node].children_.push_back(child);
+      }
+      node = child;
+      nodes_[node].has_items_below_ = true;
+    }
+    AppendItem(item, &nodes_[node].items_);
+  }
+
+  //----------------------------------------------------------------------------
+  // Mask paths are NFA; its states are (index in mask_items_, number of
+  // matched path elements). Every DFA state is a set of NFA states. All
+  // reachable DFA states are built at once, so plan is not changed while
+  // parsing, and each SAX event costs O(1) regardless of number of mask
+  // paths. Element names, which are not used in paths, can be matched by
+  // '*' only, so they share one column of transition table.
+  void Xml2VarPlan::CompileMasks()
+  {
+    other_element_id_ = str2id_.size();
+    if (mask_items_.empty())
+      return;
+
+    NfaStates initial;
+    for (size_t i = 0; i < mask_items_.size(); ++i)
+      initial.push_back(NfaState(i, 0));
+    StateIndex state_index;
+    std::vector<NfaStates> states;
+    AddMaskState(&initial, &state_index, &states);
+
+    // new states are appended while transitions are calculated
+    for (size_t state = 0; state < mask_states_.size(); ++state)
+    {
+      const NfaStates from(states[state]);
+      Indexes transitions(other_element_id_ + 1);
+      for (size_t element_id = 0; element_id < transitions.size(); ++element_id)
+      {
+        NfaStates nfa_states;
+        NfaStates::const_iterator it = from.begin(), end = from.end();
+        for (; it != end; ++it)
+        {
+          const std::vector<size_t> & elements =
+              items_[mask_items_[it->first]].path_.elements();
+          if (it->second >= elements.size())
+            continue;
+          size_t id = elements[it->second];
+          if (id == String2IdMap::DESCENDANT_ID)
+            nfa_states.push_back(*it);
+          else if (id == String2IdMap::STAR_ID || id == element_id)
+            nfa_states.push_back(NfaState(it->first, it->second + 1));
+        }
+        transitions[element_id] = AddMaskState(&nfa_states, &state_index,
+            &states);
+      }
+      mask_states_[state].transitions_.swap(transitions);
+    }
+  }
+
+  // Adds '//' epsilon transitions to 'nfa_states' and returns index
+  // of existing or new DFA state
+  size_t Xml2VarPlan::AddMaskState(NfaStates * nfa_states,
+      StateIndex * state_index, std::vector<NfaStates> * states)
+  {
+    for (size_t i = 0; i < nfa_states->size(); ++i)
+    {
+      NfaState nfa_state = (*nfa_states)[i];
+      const std::vector<size_t> & elements =
+          items_[mask_items_[nfa_state.first]].path_.elements();
+      if (nfa_state.second < elements.size() &&
+          elements[nfa_state.second] == String2IdMap::DESCENDANT_ID)
+        nfa_states->push_back(NfaState(nfa_state.first,
+            nfa_state.second + 1));
+    }
+    std::sort(nfa_states->begin(), nfa_states->end());
+    nfa_states->erase(std::unique(nfa_states->begin(), nfa_states->end()),
+        nfa_states->end());
+
+    StateIndex::const_iterator found = state_index->find(*nfa_states);
+    if (found != state_index->end())
+      return found->second;
+
+    size_t index = mask_states_.size();
+    mask_states_.push_back(MaskState());
+    states->push_back(*nfa_states);
+    MaskState & state = mask_states_.back();
+    state.alive_ = !nfa_states->empty();
+    NfaStates::const_iterator it = nfa_states->begin(),
+        end = nfa_states->end();
+    for (; it != end; ++it)
+    {
+      size_t item = mask_items_[it->first];
+      if (it->second == items_[item].path_.size())
+        state.items_.push_back(item);
+    }
+    (*state_index)[*nfa_states] = index;
+    return index;
+  }
+
+  //----------------------------------------------------------------------------
+  void Xml2VarPlan::CompilePrograms()
+  {
+    for (size_t i = 0; i < nodes_.size(); ++i)
+      CompileProgram(nodes_[i].items_, &nodes_[i].program_);
+    for (size_t i = 0; i < mask_states_.size(); ++i)
+      CompileProgram(mask_states_[i].items_, &mask_states_[i].program_);
+
+    // children of objects and lists don't use attributes
+    StringVector attributes;
+    for (size_t i = 0; i < targets_.size(); ++i)
+    {
+      const Indexes & items = targets_[i].items_;
+      Indexes::const_iterator it = items.begin(), end = items.end();
+      for (; it != end; ++it)
+        targets_[i].children_.push_back(CompileItem(*it, &attributes));
+    }
+  }
+
+  void Xml2VarPlan::CompileProgram(const Indexes & items, Program * program)
+  {
+    Indexes::const_iterator it = items.begin(), end = items.end();
+    for (; it != end; ++it)
+    {
+      Instruction instruction = CompileItem(*it, &program->attributes_);
+      // lists do nothing on start tag
+      if (instruction.type_ != LIST_TARGET ||
+          instruction.key_attribute_ != NO_INDEX)
+        program->enter_.push_back(instruction);
+      program->exit_.push_back(instruction);
+      if (instruction.type_ == SCALAR_TARGET &&
+          items_[*it].path_.attribute_name().empty())
+        program->text_.push_back(instruction.target_);
+    }
+    max_attributes_ = std::max(max_attributes_, program->attributes_.size());
+  }
+
+  Xml2VarPlan::Instruction Xml2VarPlan::CompileItem(size_t item,
+      StringVector * attributes)
+  {
+    const ItemSpec & spec = items_[item];
+    Instruction instruction;
+    instruction.type_ = targets_[spec.target_].type_;
+    instruction.item_ = item;
+    instruction.target_ = spec.target_;
+    instruction.parent_target_ = spec.parent_target_;
+    instruction.key_ = GetKeyIndex(spec.key_);
+    instruction.key_attribute_ = NO_INDEX;
+    instruction.value_attribute_ = NO_INDEX;
+    instruction.deferred_ = spec.deferred_;
+
+    if (spec.key_is_attribute_)
+    {
+      instruction.key_type_ = ATTRIBUTE_KEY;
+      instruction.key_attribute_ = GetAttributeSlot(spec.key_, attributes);
+    }
+    else if (spec.key_ == S_STAR_)
+      instruction.key_type_ = ELEMENT_KEY;
+    else
+      instruction.key_type_ = FIXED_KEY;
+
+    const std::string & attribute = spec.path_.attribute_name();
+    if (instruction.type_ == SCALAR_TARGET && !attribute.empty())
+      instruction.value_attribute_ = GetAttributeSlot(attribute, attributes);
+
+    return instruction;
+  }
+
+  size_t Xml2VarPlan::GetKeyIndex(const std::string & key)
+  {
+    StringVector::const_iterator found = std::find(keys_.begin(),
+        keys_.end(), key);
+    if (found != keys_.end())
+      return static_cast<size_t>(found - keys_.begin());
+    keys_.push_back(key);
+    key_ids_.push_back(DictKey::Register(key));
+    return keys_.size() - 1;
+  }
+
+  size_t Xml2VarPlan::GetAttributeSlot(const std::string & attribute,
+      StringVector * attributes)
+  {
+    StringVector::const_iterator found = std::find(attributes->begin(),
+        attributes->end(), attribute);
+    if (found != attributes->end())
+      return static_cast<size_t>(found - attributes->begin());
+    attributes->push_back(attribute);
+    return attributes->size() - 1;
+  }
+
 } // namespace nkit
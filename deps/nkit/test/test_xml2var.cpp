@@ -183,6 +183,219 @@ namespace nkit_test
    // CINFO(json_hr << var);
   }
 
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_mask_descendant_axis)
+  {
+    std::string error;
+    std::string xml("<root>"
+        "<a><b>1</b><c><b>2</b><d><b>3</b></d></c></a>"
+        "<e><b>4</b><c><x>5</x></c></e>"
+        "</root>");
+
+    Dynamic mapping = DDICT(
+        "descendants" << DLIST("/a//b" << "string") <<
+        "anywhere" << DLIST("//b" << "string") <<
+        "star_descendant" << DLIST("/*//d/*" << "string") <<
+        "objects" << DLIST("/*" << DDICT("/b" << "string|-" <<
+                                          "//x" << "string|-")) <<
+        "star" << DLIST("/*/c/b" << "string")
+    );
+
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder =
+        StructXml2VarBuilder<DynamicBuilder>::Create(Dynamic::Dict(), mapping,
+            &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("descendants"), DLIST("1" << "2" << "3"));
+    NKIT_TEST_EQ(builder->var("anywhere"), DLIST("1" << "2" << "3" << "4"));
+    NKIT_TEST_EQ(builder->var("star_descendant"), DLIST("3"));
+    NKIT_TEST_EQ(builder->var("objects"), DLIST(
+        DDICT("b" << "1" << "x" << "-") << DDICT("b" << "4" << "x" << "5")));
+    NKIT_TEST_EQ(builder->var("star"), DLIST("2"));
+
+    // the same builder for the next document
+    builder->Clear();
+    builder->Restart();
+    std::string xml2("<root><a><c><b>6</b></c></a></root>");
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml2.c_str(), xml2.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("anywhere"), DLIST("6"));
+    NKIT_TEST_EQ(builder->var("star"), DLIST("6"));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_skip_unmapped_subtrees)
+  {
+    std::string error;
+    std::string xml("<root>"
+        "<x><a>no</a><b><c>no</c></b></x>"
+        "<a>t1<x><y>no</y>no</x>t2</a>"
+        "<b><q><c>no</c></q><c>yes</c><d><e>1</e><f><e>2</e></f></d></b>"
+        "</root>");
+
+    Dynamic mapping = DDICT(
+        "/a" << "string" <<
+        "/b/c" << "string" <<
+        "/b/*/e -> e" << "string"
+    );
+
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder =
+        StructXml2VarBuilder<DynamicBuilder>::Create(Dynamic::Dict(),
+            DDICT("main" << mapping), &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("main"),
+        DDICT("a" << "t1t2" << "c" << "yes" << "e" << "1"));
+
+    // parse error inside of skipped subtree must not break next document
+    builder->Clear();
+    std::string bad_xml("<root><x><y>");
+    NKIT_TEST_ASSERT(
+        !builder->Feed(bad_xml.c_str(), bad_xml.length(), true, &error));
+    builder->Clear();
+    std::string xml2("<root><a>t3</a></root>");
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml2.c_str(), xml2.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("main")["a"], Dynamic("t3"));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_limit)
+  {
+    std::string error;
+    std::string xml("<root><header><title>T</title></header>"
+        "<item><a>1</a></item><item><a>2</a></item><item><a>3</a></item>");
+
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder =
+        StructXml2VarBuilder<DynamicBuilder>::Create(
+            DDICT("limit" << DDICT("main" << 2)),
+            DDICT("main" << DLIST("/item" << DDICT("/a" << "string")) <<
+                  "header" << DDICT("/header/title" << "string")), &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), false, &error), error);
+    NKIT_TEST_ASSERT(builder->finished());
+    NKIT_TEST_EQ(builder->var("main"),
+        DLIST(DDICT("a" << "1") << DDICT("a" << "2")));
+    NKIT_TEST_EQ(builder->var("header"), DDICT("title" << "T"));
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Feed("", 0, true, &error), error);
+    NKIT_TEST_ASSERT(!builder->finished());
+
+    // object mapping with list is never completed
+    builder = StructXml2VarBuilder<DynamicBuilder>::Create(
+        DDICT("limit" << Dynamic::Dict()),
+        DDICT("header" << DDICT("/header/title" << "string" <<
+                                "/item/a -> a" << DLIST("/" << "string"))),
+        &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), false, &error), error);
+    NKIT_TEST_ASSERT(!builder->finished());
+
+    NKIT_TEST_ASSERT(!StructXml2VarBuilder<DynamicBuilder>::Create(
+        DDICT("limit" << DDICT("header" << 1)),
+        DDICT("header" << DDICT("/header/title" << "string")), &error));
+    NKIT_TEST_ASSERT(!StructXml2VarBuilder<DynamicBuilder>::Create(
+        DDICT("limit" << DDICT("main" << 0)),
+        DDICT("main" << DLIST("/item" << "string")), &error));
+    NKIT_TEST_ASSERT(!StructXml2VarBuilder<DynamicBuilder>::Create(
+        DDICT("limit" << DDICT("mian" << 1)),
+        DDICT("main" << DLIST("/item" << "string")), &error));
+    NKIT_TEST_EQ(error, "Unknown mapping name: 'mian'");
+
+    // too big limit is no limit
+    builder = StructXml2VarBuilder<DynamicBuilder>::Create(
+        DDICT("limit" << DDICT("main" << 1e300)),
+        DDICT("main" << DLIST("/item" << "string")), &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), false, &error), error);
+    NKIT_TEST_ASSERT(!builder->finished());
+    NKIT_TEST_EQ(builder->var("main").size(), 3);
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_shared_plan)
+  {
+    std::string error;
+    Xml2VarPlan::Ptr plan = Xml2VarPlan::Create(Dynamic::Dict(),
+        DDICT("items" << DLIST("/item" << DDICT("/a" << "string|-" <<
+                                                "//b" << "string")) <<
+              "title" << DDICT("/title" << "string")), &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(plan, error);
+
+    // element names, which are not used in paths, do not change plan
+    NKIT_TEST_EQ(plan->GetElementId("unknown1"),
+        plan->GetElementId("unknown2"));
+
+    // documents are parsed by two builders at once
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder1 =
+        StructXml2VarBuilder<DynamicBuilder>::Create(plan);
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder2 =
+        StructXml2VarBuilder<DynamicBuilder>::Create(plan);
+    std::string xml1("<root><title>T1</title><item><a>1</a><x><b>2</b></x>");
+    std::string xml2("<root><item><b>3</b></item><title>T2</title>");
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder1->Feed(xml1.c_str(), xml1.length(), false, &error), error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder2->Feed(xml2.c_str(), xml2.length(), false, &error), error);
+    std::string end1("</item></root>"), end2("</root>");
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder1->Feed(end1.c_str(), end1.length(), true, &error), error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder2->Feed(end2.c_str(), end2.length(), true, &error), error);
+
+    NKIT_TEST_EQ(builder1->var("items"),
+        DLIST(DDICT("a" << "1" << "b" << "2")));
+    NKIT_TEST_EQ(builder1->var("title"), DDICT("title" << "T1"));
+    NKIT_TEST_EQ(builder2->var("items"),
+        DLIST(DDICT("a" << "-" << "b" << "3")));
+    NKIT_TEST_EQ(builder2->var("title"), DDICT("title" << "T2"));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_split_text)
+  {
+    // texts, which are split between chunks or contain entity references
+    // and new lines, are not taken from Expat buffer as is
+    std::string error;
+    std::string xml("<root><item><a> first </a><b>1&amp;2</b>"
+        "<c>line1\r\nline2</c></item><item><a>second</a>"
+        "<b>&lt;&gt;</b><c>\t</c></item></root>");
+    Dynamic options = DDICT("trim" << true << "explicit_array" << false);
+    Dynamic mapping = DDICT("items" << DLIST("/item" << DDICT(
+        "/a" << "string" << "/b" << "string" << "/c" << "string")));
+    Dynamic etalon = DLIST(
+        DDICT("a" << "first" << "b" << "1&2" << "c" << "line1\nline2") <<
+        DDICT("a" << "second" << "b" << "<>" << "c" << ""));
+
+    for (size_t chunk = 1; chunk <= 7; chunk += 3)
+    {
+      StructXml2VarBuilder<DynamicBuilder>::Ptr builder =
+          StructXml2VarBuilder<DynamicBuilder>::Create(options, mapping,
+              &error);
+      NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+      AnyXml2VarBuilder<DynamicBuilder>::Ptr any_builder =
+          AnyXml2VarBuilder<DynamicBuilder>::Create(options, &error);
+      NKIT_TEST_ASSERT_WITH_TEXT(any_builder, error);
+
+      for (size_t pos = 0; pos < xml.size(); pos += chunk)
+      {
+        size_t len = std::min(chunk, xml.size() - pos);
+        bool last = pos + len == xml.size();
+        NKIT_TEST_ASSERT_WITH_TEXT(
+            builder->Feed(xml.data() + pos, len, last, &error), error);
+        NKIT_TEST_ASSERT_WITH_TEXT(
+            any_builder->Feed(xml.data() + pos, len, last, &error), error);
+      }
+
+      NKIT_TEST_EQ(builder->var("items"), etalon);
+      NKIT_TEST_EQ(any_builder->var()["item"], etalon);
+    }
+  }
+
   //---------------------------------------------------------------------------
   NKIT_TEST_CASE(xml2var_list_of_objects_with_list)
   {
@@ -415,6 +628,186 @@ namespace nkit_test
     NKIT_TEST_EQ(persons, persons_etalon);
   }
 
+  //---------------------------------------------------------------------------
+  class CollectingItemListener: public ItemListener<DynamicBuilder>
+  {
+  public:
+    CollectingItemListener()
+      : items_(Dynamic::List())
+    {}
+
+    void OnItem(const std::string & target_name, const Dynamic & item)
+    {
+      items_.PushBack(DLIST(target_name << item));
+    }
+
+    Dynamic items_;
+  };
+
+  NKIT_TEST_CASE(xml2var_item_listener)
+  {
+    std::string error;
+    std::string xml_path("./data/sample.xml");
+    std::string xml;
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        text_file_to_string(xml_path, &xml, &error), error);
+
+    std::string mappings("{"
+        "\"persons\": [\"/person\", {\"/name\": \"string\"}],"
+        "\"academy\": {\"/academy/title\": \"string\"}"
+        "}");
+
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder = StructXml2VarBuilder<
+        DynamicBuilder>::Create("{\"trim\": true}", mappings, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+
+    CollectingItemListener listener;
+    NKIT_TEST_ASSERT(!builder->SetItemListener("academy", &listener, &error));
+    NKIT_TEST_ASSERT(!builder->SetItemListener("unknown", &listener, &error));
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->SetItemListener("persons", &listener, &error), error);
+
+    size_t half = xml.length() / 2;
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), half, false, &error), error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str() + half, xml.length() - half, true, &error),
+        error);
+
+    Dynamic items_etalon = DLIST(
+        DLIST("persons" << DDICT("name" << "Jack")) <<
+        DLIST("persons" << DDICT("name" << "Boris"))
+        );
+
+    NKIT_TEST_EQ(listener.items_, items_etalon);
+    NKIT_TEST_EQ(builder->var("persons"), Dynamic::List());
+    NKIT_TEST_EQ(builder->var("academy")["title"],
+        Dynamic("Delhi Academy Of Medical Sciences"));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_reuse_builder)
+  {
+    std::string error;
+    std::string xml_path("./data/sample.xml");
+    std::string xml;
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        text_file_to_string(xml_path, &xml, &error), error);
+
+    Dynamic options = DDICT("trim" << true << "explicit_array" << false);
+    Dynamic mappings = DDICT(
+        "persons" << DLIST("/person" << DDICT(
+            "/name" << "string" <<
+            "/phone -> phones" << DLIST("/" << "string"))) <<
+        "academy" << DDICT("/academy/title" << "string")
+        );
+
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder = StructXml2VarBuilder<
+        DynamicBuilder>::Create(options, mappings, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), true, &error), error);
+    Dynamic persons_etalon = builder->var("persons").Clone();
+    Dynamic academy_etalon = builder->var("academy").Clone();
+    NKIT_TEST_EQ(persons_etalon.size(), 2);
+
+    // document is interrupted in the middle of 'person' element
+    builder->Clear();
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length() / 2, false, &error), error);
+    builder->Restart();
+    builder->Clear();
+
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("persons"), persons_etalon);
+    NKIT_TEST_EQ(builder->var("academy"), academy_etalon);
+
+    NKIT_TEST_ASSERT(!StructXml2VarBuilder<DynamicBuilder>::Create(
+        options, DLIST("/person" << "string"), &error));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_number_parsing)
+  {
+    static const char * const numbers[] = {
+        "0", "-0", "1.5", " \t-12.25e-3", "+3.", ".5", "1e22", "1e23",
+        "123456789012345678901234567890", "0.1", "2.2250738585072014e-308",
+        "9007199254740993", "1.7976931348623157e308", "12abc", "1,5",
+        "0x1A", "inf", "-nan", "1e", NULL };
+    for (size_t i = 0; numbers[i]; ++i)
+    {
+      double etalon = 0.0, value = 0.0;
+      NKIT_TEST_EQ(parse_double(numbers[i], strlen(numbers[i]), &value),
+          NKIT_SSCANF(numbers[i], "%lg", &etalon) == 1);
+      if (etalon == etalon)
+      {
+        NKIT_TEST_ASSERT_WITH_TEXT(memcmp(&value, &etalon, sizeof(double)) == 0,
+            numbers[i]);
+      }
+      else
+      {
+        NKIT_TEST_ASSERT_WITH_TEXT(value != value, numbers[i]);
+      }
+    }
+
+    double value = 0.0;
+    NKIT_TEST_ASSERT(!parse_double("", 0, &value));
+    NKIT_TEST_ASSERT(!parse_double(" .e1", 4, &value));
+    NKIT_TEST_ASSERT(parse_double("2.5", 1, &value) && value == 2.0);
+
+    int64_t i = 0;
+    NKIT_TEST_ASSERT(parse_int64(" -42x", 5, &i) && i == -42);
+    NKIT_TEST_ASSERT(parse_int64("+7", 2, &i) && i == 7);
+    NKIT_TEST_ASSERT(parse_int64("9223372036854775807", 19, &i)
+        && i == std::numeric_limits<int64_t>::max());
+    NKIT_TEST_ASSERT(parse_int64("-9223372036854775808", 20, &i)
+        && i == std::numeric_limits<int64_t>::min());
+    NKIT_TEST_ASSERT(parse_int64("99999999999999999999", 20, &i)
+        && i == std::numeric_limits<int64_t>::max());
+    NKIT_TEST_ASSERT(!parse_int64("-", 1, &i));
+
+    std::string error;
+    std::string xml("<root><item><i>3000000000</i><f> 2.5</f></item>"
+        "<item><i>-7</i><f>abc</f></item></root>");
+    StructXml2VarBuilder<DynamicBuilder>::Ptr builder = StructXml2VarBuilder<
+        DynamicBuilder>::Create(DDICT("int64" << true),
+            DDICT("items" << DLIST("/item" << DDICT(
+                "/i" << "integer" << "/f" << "number"))), &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml.c_str(), xml.length(), true, &error), error);
+    NKIT_TEST_EQ(builder->var("items"), DLIST(
+        DDICT("i" << int64_t(3000000000LL) << "f" << 2.5) <<
+        DDICT("i" << int64_t(-7) << "f" << 0.0)));
+  }
+
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_string2id_map)
+  {
+    String2IdMap map;
+    NKIT_TEST_ASSERT(map.GetId("*") == String2IdMap::STAR_ID);
+    NKIT_TEST_ASSERT(map.GetId("//") == String2IdMap::DESCENDANT_ID);
+
+    static const size_t COUNT = 1000;
+    for (size_t i = 0; i < COUNT; ++i)
+      NKIT_TEST_EQ(map.GetId(("el" + string_cast(i)).c_str()), i + 2);
+
+    String2IdMap copy;
+    copy.GetId("other");
+    copy = map;
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+      std::string name("el" + string_cast(i));
+      NKIT_TEST_EQ(copy.GetId(name.c_str()), i + 2);
+      NKIT_TEST_EQ(copy.GetString(i + 2), name);
+    }
+    NKIT_TEST_EQ(copy.GetString(COUNT + 2), std::string(""));
+    NKIT_TEST_EQ(copy.GetId("other"), COUNT + 2);
+    NKIT_TEST_EQ(map.GetId("other"), COUNT + 2);
+  }
+
   //---------------------------------------------------------------------------
   NKIT_TEST_CASE(xml2var_attribute_as_key)
   {
@@ -569,6 +962,71 @@ namespace nkit_test
     NKIT_TEST_EQ(root_name, "root");
   }
 
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_any_item_listener)
+  {
+    const char * xml = "<?xml version='1.0' encoding='utf-8'?>"
+            "\n" "<root>"
+            "\n" "  <header>h</header>"
+            "\n" "  <offer id='1'><price>10</price></offer>"
+            "\n" "  <offer><price>20</price>text</offer>"
+            "\n" "  <note>n</note>"
+            "\n" "</root>"
+            ;
+    std::string error;
+    Dynamic options = DDICT(
+      "trim" << true <<
+      "explicit_array" << false
+    );
+    AnyXml2VarBuilder<DynamicBuilder>::Ptr builder =
+        AnyXml2VarBuilder<DynamicBuilder>::Create(options, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder, error);
+
+    std::set<std::string> names;
+    names.insert("offer");
+    names.insert("note");
+    CollectingItemListener listener;
+    builder->SetItemListener(&listener, names);
+
+    // records are split between chunks
+    size_t half = strlen(xml) / 2;
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Feed(xml, half, false, &error),
+        error);
+    NKIT_TEST_ASSERT_WITH_TEXT(
+        builder->Feed(xml + half, strlen(xml) - half, true, &error), error);
+
+    Dynamic items_etalon = DLIST(
+        DLIST("offer" << DDICT("$" << DDICT("id" << "1") <<
+            "price" << "10")) <<
+        DLIST("offer" << DDICT("price" << "20" << "_" << "text")) <<
+        DLIST("note" << "n")
+        );
+    NKIT_TEST_EQ(listener.items_, items_etalon);
+    NKIT_TEST_EQ(builder->var(), DDICT("header" << "h"));
+
+    // deeper records, listener is kept after Clear()
+    options["emit_depth"] = Dynamic(2);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Clear(options, &error), error);
+    builder->Restart();
+    listener.items_ = Dynamic::List();
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Feed(xml, strlen(xml), true, &error),
+        error);
+    NKIT_TEST_EQ(listener.items_, Dynamic::List());
+
+    names.clear();
+    builder->SetItemListener(&listener, names);
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Clear(options, &error), error);
+    builder->Restart();
+    NKIT_TEST_ASSERT_WITH_TEXT(builder->Feed(xml, strlen(xml), true, &error),
+        error);
+    NKIT_TEST_EQ(listener.items_,
+        DLIST(DLIST("price" << "10") << DLIST("price" << "20")));
+    NKIT_TEST_EQ(builder->var()["offer"].size(), 2);
+
+    options["emit_depth"] = Dynamic(0);
+    NKIT_TEST_ASSERT(!builder->Clear(options, &error));
+  }
+
   //---------------------------------------------------------------------------
   NKIT_TEST_CASE(xml2var_true_false_variants)
   {
@@ -633,5 +1091,78 @@ namespace nkit_test
             Dynamic(false));
   }
 
+  //---------------------------------------------------------------------------
+  NKIT_TEST_CASE(xml2var_namespaces)
+  {
+    const char * xml = "<?xml version='1.0' encoding='utf-8'?>"
+            "\n" "<s:Envelope xmlns:s='http://schemas.xmlsoap.org/soap/envelope/'"
+            "\n" "    xmlns:a='urn:a' xmlns:b='urn:b'>"
+            "\n" "  <s:Body>"
+            "\n" "    <a:item a:id='1'><a:name>x</a:name><b:name>y</b:name></a:item>"
+            "\n" "    <a:item id='2'><a:name>z</a:name></a:item>"
+            "\n" "  </s:Body>"
+            "\n" "</s:Envelope>"
+            ;
+
+    // "{uri}local" matches namespace, local name matches any namespace
+    Dynamic mapping = DLIST(
+        "/{http://schemas.xmlsoap.org/soap/envelope/}Body/item" << DDICT(
+            "/@id" << "string" <<
+            "/{urn:b}name -> b_name" << "string|-" <<
+            "/name" << "string"
+            )
+        );
+    Dynamic options = DDICT("namespaces" << true);
+
+    std::string root_name, error;
+    Dynamic data = DynamicFromXml(xml, options, mapping, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(data, error);
+    CINFO(data);
+    NKIT_TEST_EQ(data, DLIST(
+        DDICT("id" << "1" << "b_name" << "y" << "name" << "x") <<
+        DDICT("id" << "2" << "b_name" << "-" << "name" << "z")
+        ));
+
+    // prefixes don't matter
+    data = DynamicFromXml("<Envelope xmlns='http://schemas.xmlsoap.org/soap/"
+        "envelope/'><Body><item id='3'><n:name xmlns:n='urn:n'>w</n:name>"
+        "</item></Body></Envelope>", options, mapping, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(data, error);
+    NKIT_TEST_EQ(data, DLIST(
+        DDICT("id" << "3" << "b_name" << "-" << "name" << "w")));
+
+    // without "namespaces" option names are matched as written
+    data = DynamicFromXml(xml, mapping, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(error.empty(), error);
+    NKIT_TEST_EQ(data, Dynamic::List());
+
+    // keys of AnyXml2VarBuilder
+    options = DDICT(
+      "namespaces" << true <<
+      "explicit_array" << false
+    );
+    data = DynamicFromAnyXml(xml, options, &root_name, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(data, error);
+    CINFO(root_name << "\n" << data);
+    NKIT_TEST_EQ(root_name,
+        "{http://schemas.xmlsoap.org/soap/envelope/}Envelope");
+    NKIT_TEST_EQ(data["{http://schemas.xmlsoap.org/soap/envelope/}Body"]
+        ["{urn:a}item"][(const size_t)0]["$"]["{urn:a}id"], Dynamic("1"));
+
+    options["namespaces"] = Dynamic("strip");
+    data = DynamicFromAnyXml(xml, options, &root_name, &error);
+    NKIT_TEST_ASSERT_WITH_TEXT(data, error);
+    CINFO(root_name << "\n" << data);
+    NKIT_TEST_EQ(root_name, "Envelope");
+    const Dynamic & items = data["Body"]["item"];
+    NKIT_TEST_EQ(items.size(), 2);
+    NKIT_TEST_EQ(items[(const size_t)0]["$"]["id"], Dynamic("1"));
+    NKIT_TEST_EQ(items[(const size_t)0]["name"], DLIST("x" << "y"));
+    NKIT_TEST_EQ(items[(const size_t)1]["$"]["id"], Dynamic("2"));
+
+    options["namespaces"] = Dynamic("prefix");
+    NKIT_TEST_ASSERT(!DynamicFromAnyXml(xml, options, &root_name, &error));
+  }
+
 } // namespace nkit_test
 
@@ -3,4 +3,68 @@ var nkit = null;
 nkit = require(__dirname + '/build/Release/nkit4nodejs.node');
 // nkit = require(__dirname + '/build/Debug/nkit4nodejs.node');
 
+// Asynchronous methods of native builders accept node-style callback as last
+// argument. If callback is omitted, Promise is returned instead.
+function callbackOrPromise(method) {
+    return function () {
+        var self = this;
+        var args = Array.prototype.slice.call(arguments);
+        if (typeof args[args.length - 1] === 'function')
+            return method.apply(self, args);
+
+        return new Promise(function (resolve, reject) {
+            args.push(function (error, result) {
+                if (error)
+                    reject(error);
+                else
+                    resolve(result);
+            });
+            method.apply(self, args);
+        });
+    };
+}
+
+// feed(chunk, {sliceMs: N}, callback): native feed() parses chunk until
+// time budget is spent, the rest of chunk is parsed by resume() in
+// setImmediate() callbacks, so event loop is blocked for about N ms at once.
+// Callback gets result of feed() when chunk is parsed (or builder is paused
+// by pause()).
+function slicedFeed(feed) {
+    return function (chunk, options, callback) {
+        var self = this;
+        if (typeof callback !== 'function')
+            return feed.apply(self, arguments);
+
+        function step(parse) {
+            var result;
+            try {
+                result = parse();
+            } catch (e) {
+                return callback(e);
+            }
+            if (!self.isSuspended() || (self.isPaused && self.isPaused()))
+                return callback(null, result);
+            setImmediate(function () {
+                step(function () {
+                    return self.resume(options);
+                });
+            });
+        }
+
+        step(function () {
+            return feed.call(self, chunk, options);
+        });
+    };
+}
+
+[nkit.Xml2VarBuilder, nkit.AnyXml2VarBuilder].forEach(function (Builder) {
+    ['feedAsync', 'endAsync'].forEach(function (name) {
+        Builder.prototype[name] = callbackOrPromise(Builder.prototype[name]);
+    });
+    Builder.prototype.feed = slicedFeed(Builder.prototype.feed);
+});
+
+nkit.Xml2VarBuilder.prototype.parseParallelAsync = callbackOrPromise(
+    nkit.Xml2VarBuilder.prototype.parseParallelAsync);
+
 module.exports = nkit;
@@ -19,6 +19,7 @@
 #include <node_buffer.h>
 
 #include "anyxml2var_builder_wrapper.h"
+#include "time_slice.h"
 
 #include "nkit/xml2var.h"
 
@@ -42,22 +43,27 @@ namespace nkit
 
   //------------------------------------------------------------------------------
   template <typename T>
-  bool parse_object(const T & arg, std::string * out)
+  bool parse_object(const T & arg, const char * name, Dynamic * out,
+      std::string * error)
   {
     if (node::Buffer::HasInstance(arg))
     {
       char* data;
       size_t length;
       get_buffer_data(arg, &data, &length);
-      out->assign(data, length);
+      *out = DynamicFromJson(std::string(data, length), error);
+      return !out->IsUndef();
     }
     else if (arg->IsString())
-      out->assign(*String::Utf8Value(arg));
+    {
+      *out = DynamicFromJson(*String::Utf8Value(arg), error);
+      return !out->IsUndef();
+    }
     else if (arg->IsObject())
-      out->assign(v8var_to_json(arg));
-    else
-      return false;
-    return true;
+      return v8var_to_dynamic(arg, out, error);
+
+    *error = std::string(name) + " parameter must be JSON-string or Object";
+    return false;
   }
 
   //------------------------------------------------------------------------------
@@ -78,6 +84,16 @@ namespace nkit
     Nan::SetPrototypeMethod(tpl, "get", AnyXml2VarBuilderWrapper::Get);
     Nan::SetPrototypeMethod(tpl, "root_name",
             AnyXml2VarBuilderWrapper::GetRootName);
+    Nan::SetPrototypeMethod(tpl, "feedAsync",
+            AnyXml2VarBuilderWrapper::FeedAsync);
+    Nan::SetPrototypeMethod(tpl, "endAsync",
+            AnyXml2VarBuilderWrapper::EndAsync);
+    Nan::SetPrototypeMethod(tpl, "onItem",
+            AnyXml2VarBuilderWrapper::SetItemCallback);
+    Nan::SetPrototypeMethod(tpl, "reset", AnyXml2VarBuilderWrapper::Reset);
+    Nan::SetPrototypeMethod(tpl, "resume", AnyXml2VarBuilderWrapper::Resume);
+    Nan::SetPrototypeMethod(tpl, "isSuspended",
+            AnyXml2VarBuilderWrapper::IsSuspended);
     constructor.Reset(tpl->GetFunction());
     exports->Set(Nan::New("AnyXml2VarBuilder").ToLocalChecked(),
         tpl->GetFunction());
@@ -94,23 +110,33 @@ namespace nkit
       return Nan::ThrowError("Can't call constructor as a function");
     }
 
-    std::string options("{}"), mappings;
+    Dynamic options;
+    std::string error;
     if (1 != info.Length())
       return Nan::ThrowError("Expected exactly one argument - options");
-    else
+    else if (!parse_object(info[0], "Options", &options, &error))
+      return Nan::ThrowError(error.c_str());
+
+    Dynamic * native;
+    bool is_native = options.IsDict() && options.Get("native", &native)
+        && *native;
+
+    // native builder checks options itself
+    AnyXml2VarBuilder<V8VarBuilder>::Ptr builder;
+    if (!is_native)
     {
-      if (!parse_object(info[0], &options))
-        return Nan::ThrowError("Options parameter must be JSON-string or Object");
+      builder = AnyXml2VarBuilder<V8VarBuilder>::Create(options, &error);
+      if (!builder)
+        return Nan::ThrowError(error.c_str());
     }
 
-    std::string error;
-    AnyXml2VarBuilder<V8VarBuilder>::Ptr builder =
-        AnyXml2VarBuilder<V8VarBuilder>::Create(options, &error);
-
-    if (!builder)
+    AnyXml2VarBuilderWrapper* obj =
+        new AnyXml2VarBuilderWrapper(builder, options, is_native);
+    if (is_native && !obj->CreateNativeBuilder(&error))
+    {
+      delete obj;
       return Nan::ThrowError(error.c_str());
-
-    AnyXml2VarBuilderWrapper* obj = new AnyXml2VarBuilderWrapper(builder);
+    }
     obj->Wrap(info.This());
     info.GetReturnValue().Set(info.This());
   }
@@ -126,26 +152,41 @@ namespace nkit
     AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
         info.This());
 
-    bool result = false;
+    bool parsed = false;
     std::string error;
+    if (!obj->SetMode(MODE_SYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->suspended())
+      return Nan::ThrowError(
+          "Chunk is not parsed completely: call resume() first");
+
+    uint64_t deadline;
+    if (!get_deadline(info.Length() > 1 ? info[1] : Local<Value>(
+        Nan::Undefined()), &deadline, &error))
+      return Nan::ThrowError(error.c_str());
+
     if (node::Buffer::HasInstance(info[0]))
     {
       char* data;
       size_t length;
       get_buffer_data(info[0], &data, &length);
 
-      result = obj->builder_->Feed(data, length, false, &error);
+      if (!obj->ParseSync(data, length, false, false, deadline, &parsed,
+          &error))
+        return;
     }
     else if (info[0]->IsString())
     {
       String::Utf8Value utf8_value(info[0]);
-      result = obj->builder_->Feed(
-          *utf8_value, utf8_value.length(), false, &error);
+      if (!obj->ParseSync(*utf8_value, utf8_value.length(), false, false,
+          deadline, &parsed, &error))
+        return;
     }
     else
       return Nan::ThrowTypeError("Expected String or Buffer parameter");
 
-    if (!result)
+    if (!parsed)
       return Nan::ThrowError(error.c_str());
 
     info.GetReturnValue().Set(Nan::Undefined());
@@ -158,8 +199,14 @@ namespace nkit
 
     AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
         info.This());
-    Local<Object> result = Local<Object>::Cast(
-        Nan::New<Value>(obj->builder_->var()));
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    Local<Object> result;
+    if (obj->mode_ == MODE_ASYNC || obj->native_)
+      result = Local<Object>::Cast(dynamic_to_v8var(obj->async_builder_->var()));
+    else
+      result = Local<Object>::Cast(Nan::New<Value>(obj->builder_->var()));
     info.GetReturnValue().Set(result);
   }
 
@@ -170,8 +217,13 @@ namespace nkit
 
     AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
         info.This());
-    Local<String> result =
-            Nan::New<String>(obj->builder_->root_name()).ToLocalChecked();
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    const std::string & root_name =
+        obj->mode_ == MODE_ASYNC || obj->native_ ?
+        obj->async_builder_->root_name() : obj->builder_->root_name();
+    Local<String> result = Nan::New<String>(root_name).ToLocalChecked();
     info.GetReturnValue().Set(result);
   }
 
@@ -185,12 +237,385 @@ namespace nkit
 
     std::string empty = "";
     std::string error;
-    if (!obj->builder_->Feed(empty.c_str(), empty.size(), true, &error))
+    if (!obj->SetMode(MODE_SYNC, &error))
       return Nan::ThrowError(error.c_str());
 
+    if (obj->suspended())
+      return Nan::ThrowError(
+          "Chunk is not parsed completely: call resume() first");
+
+    bool parsed;
+    if (!obj->ParseSync(empty.c_str(), empty.size(), true, false, 0, &parsed,
+        &error))
+      return;
+
+    if (!parsed)
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->native_)
+    {
+      info.GetReturnValue().Set(obj->AsyncResult());
+      return;
+    }
+
     Local<Value> result = Nan::New(obj->builder_->var());
 //    obj->builder_->Clear();
     info.GetReturnValue().Set(result);
   }
 
+  //----------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::FeedAsync)
+  {
+    Nan::HandleScope scope;
+
+    if (2 > info.Length() || !info[1]->IsFunction())
+      return Nan::ThrowError("Expected String or Buffer parameter"
+          " and callback function");
+
+    if (!node::Buffer::HasInstance(info[0]) && !info[0]->IsString())
+      return Nan::ThrowTypeError("Expected String or Buffer parameter");
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+
+    std::string error;
+    if (!obj->SetMode(MODE_ASYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->busy_ = true;
+    Nan::Callback * callback = new Nan::Callback(
+        Local<Function>::Cast(info[1]));
+    Nan::AsyncQueueWorker(new FeedAsyncWorker<AnyXml2VarBuilderWrapper>(
+        callback, obj, info.This(), info[0], false));
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //------------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::EndAsync)
+  {
+    Nan::HandleScope scope;
+
+    if (1 > info.Length() || !info[0]->IsFunction())
+      return Nan::ThrowError("Expected callback function");
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+
+    std::string error;
+    if (!obj->SetMode(MODE_ASYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->busy_ = true;
+    Nan::Callback * callback = new Nan::Callback(
+        Local<Function>::Cast(info[0]));
+    Nan::AsyncQueueWorker(new FeedAsyncWorker<AnyXml2VarBuilderWrapper>(
+        callback, obj, info.This(), Nan::EmptyString(), true));
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //------------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::SetItemCallback)
+  {
+    Nan::HandleScope scope;
+
+    int callback_index = info.Length() > 1 ? 1 : 0;
+    if (1 > info.Length() || !info[callback_index]->IsFunction()
+        || (callback_index == 1 && !info[0]->IsString()))
+      return Nan::ThrowError("Expected optional element name"
+          " and callback function");
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    std::string element_name;
+    if (callback_index == 1)
+    {
+      String::Utf8Value utf8_value(info[0]);
+      element_name.assign(*utf8_value, utf8_value.length());
+    }
+
+    Nan::Callback *& callback = obj->item_callbacks_[element_name];
+    delete callback;
+    callback = new Nan::Callback(Local<Function>::Cast(info[callback_index]));
+    obj->SetItemListeners();
+
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //------------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::Reset)
+  {
+    Nan::HandleScope scope;
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    if (obj->builder_)
+    {
+      obj->builder_->Restart();
+      obj->builder_->Clear();
+    }
+    if (obj->async_builder_)
+    {
+      obj->async_builder_->Restart();
+      obj->async_builder_->Clear();
+    }
+    obj->mode_ = MODE_NONE;
+    obj->pending_names_.clear();
+    obj->pending_items_.Reset(Nan::New<Array>());
+    obj->async_items_.clear();
+
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //------------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::Resume)
+  {
+    Nan::HandleScope scope;
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    std::string error;
+    uint64_t deadline;
+    if (!get_deadline(info[0], &deadline, &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->suspended())
+    {
+      bool parsed;
+      if (!obj->ParseSync(NULL, 0, false, true, deadline, &parsed, &error))
+        return;
+      if (!parsed)
+        return Nan::ThrowError(error.c_str());
+    }
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //------------------------------------------------------------------------------
+  NAN_METHOD(AnyXml2VarBuilderWrapper::IsSuspended)
+  {
+    Nan::HandleScope scope;
+
+    AnyXml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<AnyXml2VarBuilderWrapper>(
+        info.This());
+    info.GetReturnValue().Set(Nan::New(obj->suspended()));
+  }
+
+  //------------------------------------------------------------------------------
+  // Parses chunk in the main thread (or continues parsing of suspended
+  // chunk if 'resume' is true) and passes elements of "emit_depth" to
+  // onItem() callbacks after every ELEMENTS_PER_TIME_CHECK elements.
+  // V8 builder is suspended so often even without time budget: values of
+  // elements are local handles of HandleScope around one Feed()/Resume(),
+  // so the scope is closed (and open elements are persisted) regularly.
+  // Native builder is suspended only for time budget and for callbacks.
+  // If 'deadline' is set, the rest of chunk is left for resume() as soon
+  // as deadline is reached ('last' chunk is always parsed completely).
+  // Returns false if callback has thrown exception.
+  bool AnyXml2VarBuilderWrapper::ParseSync(const char * data, size_t length,
+      bool last, bool resume, uint64_t deadline, bool * parsed,
+      std::string * error)
+  {
+    if (native_)
+      async_builder_->SetSuspendInterval(deadline || !item_callbacks_.empty()
+          ? ELEMENTS_PER_TIME_CHECK : 0);
+    else
+      builder_->SetSuspendInterval(ELEMENTS_PER_TIME_CHECK);
+    {
+      Nan::HandleScope scope;
+      if (resume)
+        *parsed = ResumeParser(error);
+      else if (native_)
+        *parsed = async_builder_->Feed(data, length, last, error);
+      else
+        *parsed = builder_->Feed(data, length, last, error);
+    }
+    while (true)
+    {
+      if (!EmitItems(false))
+        return false;
+      if (!*parsed || !suspended())
+        return true;
+      if (!last && deadline && uv_hrtime() >= deadline)
+        return true;
+      Nan::HandleScope scope;
+      *parsed = ResumeParser(error);
+    }
+  }
+
+  //------------------------------------------------------------------------------
+  bool AnyXml2VarBuilderWrapper::ResumeParser(std::string * error)
+  {
+    if (native_)
+      return async_builder_->Resume(error);
+    return builder_->Resume(error);
+  }
+
+  //------------------------------------------------------------------------------
+  bool AnyXml2VarBuilderWrapper::suspended() const
+  {
+    if (native_)
+      return async_builder_->suspended();
+    return builder_->suspended();
+  }
+
+  //------------------------------------------------------------------------------
+  bool AnyXml2VarBuilderWrapper::SetMode(Mode mode, std::string * error)
+  {
+    if (busy_)
+    {
+      *error = "Builder is busy with asynchronous operation";
+      return false;
+    }
+
+    if (mode_ == MODE_NONE)
+    {
+      if (mode == MODE_ASYNC && !async_builder_
+          && !CreateNativeBuilder(error))
+        return false;
+      mode_ = mode;
+    }
+    else if (mode_ != mode)
+    {
+      *error = "Can't mix synchronous and asynchronous methods"
+          " on one builder";
+      return false;
+    }
+
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  bool AnyXml2VarBuilderWrapper::CreateNativeBuilder(std::string * error)
+  {
+    async_builder_ = AsyncBuilder::Create(options_, error);
+    if (!async_builder_)
+      return false;
+    SetItemListeners();
+    return true;
+  }
+
+  //------------------------------------------------------------------------------
+  Local<Value> AnyXml2VarBuilderWrapper::AsyncResult() const
+  {
+    Nan::EscapableHandleScope scope;
+    return scope.Escape(dynamic_to_v8var(async_builder_->var()));
+  }
+
+  //------------------------------------------------------------------------------
+  AnyXml2VarBuilderWrapper::~AnyXml2VarBuilderWrapper()
+  {
+    ItemCallbacks::iterator it = item_callbacks_.begin(),
+        end = item_callbacks_.end();
+    for (; it != end; ++it)
+      delete it->second;
+    pending_items_.Reset();
+  }
+
+  //------------------------------------------------------------------------------
+  // Builders filter elements by names of callbacks, unless there is
+  // callback for any element
+  void AnyXml2VarBuilderWrapper::SetItemListeners()
+  {
+    std::set<std::string> names;
+    ItemCallbacks::const_iterator it = item_callbacks_.begin(),
+        end = item_callbacks_.end();
+    for (; it != end; ++it)
+      names.insert(it->first);
+    if (names.find(S_EMPTY_) != names.end())
+      names.clear();
+
+    ItemListener<V8VarBuilder> * listener = NULL;
+    ItemListener<DynamicBuilder> * async_listener = NULL;
+    if (!item_callbacks_.empty())
+    {
+      listener = this;
+      async_listener = this;
+    }
+    if (builder_)
+      builder_->SetItemListener(listener, names);
+    if (async_builder_)
+      async_builder_->SetItemListener(async_listener, names);
+  }
+
+  //------------------------------------------------------------------------------
+  void AnyXml2VarBuilderWrapper::OnItem(const std::string & element_name,
+      const V8VarBuilder::type & item)
+  {
+    Nan::HandleScope scope;
+    Local<Array> items = Nan::New(pending_items_);
+    Nan::Set(items, static_cast<uint32_t>(pending_names_.size()),
+        Nan::New(item));
+    pending_names_.push_back(element_name);
+  }
+
+  //------------------------------------------------------------------------------
+  void AnyXml2VarBuilderWrapper::OnItem(const std::string & element_name,
+      const Dynamic & item)
+  {
+    // called from libuv thread pool: no V8 here
+    async_items_.push_back(std::make_pair(element_name, item));
+  }
+
+  //------------------------------------------------------------------------------
+  // Callback gets element value and element name
+  bool AnyXml2VarBuilderWrapper::EmitItems(bool is_async)
+  {
+    Nan::HandleScope scope;
+
+    // callbacks may call methods of this builder, so queues are detached
+    // before calling
+    StringVector names;
+    names.swap(pending_names_);
+    Local<Array> items = Nan::New(pending_items_);
+    if (!names.empty())
+      pending_items_.Reset(Nan::New<Array>());
+    AsyncItems async_items;
+    async_items.swap(async_items_);
+
+    size_t count = names.size() + async_items.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+      Local<Value> argv[2];
+      const std::string * name;
+      if (i < names.size())
+      {
+        name = &names[i];
+        argv[0] = Nan::Get(items, static_cast<uint32_t>(i)).ToLocalChecked();
+      }
+      else
+      {
+        const AsyncItems::value_type & async_item =
+            async_items[i - names.size()];
+        name = &async_item.first;
+        argv[0] = dynamic_to_v8var(async_item.second);
+      }
+      argv[1] = Nan::New(*name).ToLocalChecked();
+
+      ItemCallbacks::const_iterator callback = item_callbacks_.find(*name);
+      if (callback == item_callbacks_.end())
+        callback = item_callbacks_.find(S_EMPTY_);
+      if (callback == item_callbacks_.end())
+        continue;
+
+      if (is_async)
+        callback->second->Call(2, argv);
+      else if (callback->second->GetFunction()->Call(
+          Nan::GetCurrentContext()->Global(), 2, argv).IsEmpty())
+        return false; // exception in callback
+    }
+
+    return true;
+  }
+
 }  // namespace nkit
@@ -20,33 +20,96 @@
 #include <node_object_wrap.h>
 #include <nan.h>
 #include "v8_var_policy.h"
+#include "feed_async_worker.h"
+
+#include "nkit/dynamic/dynamic_builder.h"
 
 namespace nkit
 {
   typedef VarBuilder<V8BuilderPolicy> V8VarBuilder;
 
   class AnyXml2VarBuilderWrapper: public Nan::ObjectWrap
+    , private ItemListener<V8VarBuilder>
+    , private ItemListener<DynamicBuilder>
   {
+    friend class FeedAsyncWorker<AnyXml2VarBuilderWrapper>;
+    typedef AnyXml2VarBuilder<DynamicBuilder> AsyncBuilder;
+    typedef std::map<std::string, Nan::Callback *> ItemCallbacks;
+    typedef std::vector<std::pair<std::string, Dynamic> > AsyncItems;
+
+    enum Mode
+    {
+      MODE_NONE,
+      MODE_SYNC,
+      MODE_ASYNC
+    };
+
   public:
     static void Init(v8::Handle<v8::Object> exports);
 
   private:
-    explicit AnyXml2VarBuilderWrapper(AnyXml2VarBuilder<V8VarBuilder>::Ptr builder)
+    AnyXml2VarBuilderWrapper(AnyXml2VarBuilder<V8VarBuilder>::Ptr builder,
+        const Dynamic & options, bool native)
       : builder_(builder)
-    {}
+      , async_builder_()
+      , options_(options)
+      , mode_(MODE_NONE)
+      , busy_(false)
+      , native_(native)
+    {
+      pending_items_.Reset(Nan::New<v8::Array>());
+    }
 
-    ~AnyXml2VarBuilderWrapper()
-    {}
+    ~AnyXml2VarBuilderWrapper();
 
     static NAN_METHOD(New);
     static NAN_METHOD(Feed);
     static NAN_METHOD(Get);
     static NAN_METHOD(GetRootName);
     static NAN_METHOD(End);
+    static NAN_METHOD(FeedAsync);
+    static NAN_METHOD(EndAsync);
+    static NAN_METHOD(SetItemCallback);
+    static NAN_METHOD(Reset);
+    static NAN_METHOD(Resume);
+    static NAN_METHOD(IsSuspended);
+
+    bool SetMode(Mode mode, std::string * error);
+    bool ParseSync(const char * data, size_t length, bool last, bool resume,
+        uint64_t deadline, bool * parsed, std::string * error);
+    bool ResumeParser(std::string * error);
+    bool suspended() const;
+    bool CreateNativeBuilder(std::string * error);
+    v8::Local<v8::Value> AsyncResult() const;
+    void SetItemListeners();
+
+    // ItemListener interfaces: elements of "emit_depth" are queued during
+    // parsing and are passed to JavaScript callbacks by EmitItems() after
+    // parsing of chunk (or of its slice)
+    void OnItem(const std::string & element_name,
+        const V8VarBuilder::type & item);
+    void OnItem(const std::string & element_name, const Dynamic & item);
+    bool EmitItems(bool is_async);
 
     static Nan::Persistent<v8::Function> constructor;
 
+    // Builder of V8 values for feed() and end(): is not created with
+    // "native" option
     AnyXml2VarBuilder<V8VarBuilder>::Ptr builder_;
+    // Native builder for feedAsync()/endAsync() and for "native" mode:
+    // is used from libuv thread pool, so it must not contain any V8 values
+    AsyncBuilder::Ptr async_builder_;
+    Dynamic options_;
+    Mode mode_;
+    bool busy_;
+    // "native" option: feed() and end() build data in native builder too,
+    // it is converted to V8 values by get() and end() at once
+    bool native_;
+    // callbacks of onItem() by element names ("" - for any element)
+    ItemCallbacks item_callbacks_;
+    StringVector pending_names_;
+    Nan::Persistent<v8::Array> pending_items_;
+    AsyncItems async_items_;
   };
 
 }  // namespace nkit
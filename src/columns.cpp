@@ -0,0 +1,222 @@
+/*
+ Copyright 2014 Boris T. Darchiev (boris.darchiev@gmail.com)
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#include <node.h>
+#include <nan.h>
+#include "columns.h"
+#include "v8_var_policy.h"
+
+namespace nkit
+{
+  using namespace v8;
+
+  static const size_t COLUMN_INITIAL_CAPACITY = 256;
+
+  //----------------------------------------------------------------------------
+  static void free_numbers(char * data, void * NKIT_UNUSED(hint))
+  {
+    free(data);
+  }
+
+  //----------------------------------------------------------------------------
+  Column::Column()
+    : numbers_(NULL)
+    , size_(0)
+    , capacity_(0)
+    , numeric_(true)
+    , values_(Dynamic::List())
+  {}
+
+  Column::~Column()
+  {
+    free(numbers_);
+  }
+
+  void Column::Clear()
+  {
+    free(numbers_);
+    numbers_ = NULL;
+    size_ = 0;
+    capacity_ = 0;
+    numeric_ = true;
+    values_ = Dynamic::List();
+  }
+
+  void Column::Pad(size_t size)
+  {
+    while (size_ < size)
+    {
+      if (numeric_)
+        Append(Dynamic(std::numeric_limits<double>::quiet_NaN()));
+      else
+        Append(Dynamic::None());
+    }
+  }
+
+  void Column::Append(const Dynamic & value)
+  {
+    if (numeric_ && !value.IsNumber())
+      ConvertToList();
+
+    if (!numeric_)
+    {
+      values_.PushBack(value);
+      ++size_;
+      return;
+    }
+
+    if (unlikely(size_ == capacity_))
+    {
+      size_t capacity = capacity_ ? capacity_ * 2 : COLUMN_INITIAL_CAPACITY;
+      double * numbers = static_cast<double *>(
+          realloc(numbers_, capacity * sizeof(double)));
+      if (!numbers)
+        abort();
+      numbers_ = numbers;
+      capacity_ = capacity;
+    }
+
+    if (value.IsFloat())
+      numbers_[size_++] = value.GetFloat();
+    else if (value.IsSignedInteger())
+      numbers_[size_++] = static_cast<double>(value.GetSignedInteger());
+    else
+      numbers_[size_++] = static_cast<double>(value.GetUnsignedInteger());
+  }
+
+  void Column::ConvertToList()
+  {
+    for (size_t i = 0; i < size_; ++i)
+    {
+      if (numbers_[i] != numbers_[i]) // NaN
+        values_.PushBack(Dynamic::None());
+      else
+        values_.PushBack(Dynamic(numbers_[i]));
+    }
+    free(numbers_);
+    numbers_ = NULL;
+    capacity_ = 0;
+    numeric_ = false;
+  }
+
+  Local<Value> Column::ToV8(bool release)
+  {
+    Nan::EscapableHandleScope scope;
+
+    if (!numeric_)
+    {
+      Local<Value> list = dynamic_to_v8var(values_);
+      if (release)
+        Clear();
+      return scope.Escape(list);
+    }
+
+#if NODE_MODULE_VERSION >= NODE_4_0_MODULE_VERSION
+    size_t byte_length = size_ * sizeof(double);
+    Local<ArrayBuffer> array_buffer;
+    size_t byte_offset = 0;
+    if (release && size_)
+    {
+      // Buffer takes ownership of memory and frees it on garbage collection
+      Local<Uint8Array> buffer = Local<Uint8Array>::Cast(
+          Nan::NewBuffer(reinterpret_cast<char *>(numbers_), byte_length,
+              free_numbers, NULL).ToLocalChecked());
+      numbers_ = NULL;
+      size_ = 0;
+      capacity_ = 0;
+      array_buffer = buffer->Buffer();
+      byte_offset = buffer->ByteOffset();
+    }
+    else
+    {
+      array_buffer = ArrayBuffer::New(Isolate::GetCurrent(), byte_length);
+      if (byte_length)
+        memcpy(array_buffer->GetContents().Data(), numbers_, byte_length);
+    }
+    return scope.Escape(Float64Array::New(array_buffer, byte_offset,
+        byte_length / sizeof(double)));
+#else
+    // old node versions: no Buffer based typed arrays, numbers are copied
+    // to ordinary Array
+    Local<Array> array = Nan::New<Array>(static_cast<int>(size_));
+    for (size_t i = 0; i < size_; ++i)
+      Nan::Set(array, static_cast<uint32_t>(i), Nan::New(numbers_[i]));
+    if (release)
+      Clear();
+    return scope.Escape(array);
+#endif
+  }
+
+  //----------------------------------------------------------------------------
+  Columns::Columns()
+    : count_(0)
+    , scalars_(false)
+  {}
+
+  void Columns::Clear()
+  {
+    count_ = 0;
+    scalars_ = false;
+    values_.Clear();
+    columns_.clear();
+  }
+
+  void Columns::Append(const Dynamic & item)
+  {
+    if (!item.IsDict())
+    {
+      scalars_ = true;
+      values_.Append(item);
+      return;
+    }
+
+    DDICT_FOREACH(pair, item)
+    {
+      Column::Ptr & column = columns_[pair->first];
+      if (!column)
+        column = Column::Ptr(new Column);
+      column->Pad(count_);
+      column->Append(pair->second);
+    }
+    ++count_;
+  }
+
+  Local<Value> Columns::ToV8(bool release)
+  {
+    Nan::EscapableHandleScope scope;
+
+    if (scalars_)
+      return scope.Escape(values_.ToV8(release));
+
+    Local<Object> result = Nan::New<Object>();
+    ColumnMap::iterator it = columns_.begin(), end = columns_.end();
+    for (; it != end; ++it)
+    {
+      it->second->Pad(count_);
+      Nan::Set(result, Nan::New(it->first).ToLocalChecked(),
+          it->second->ToV8(release));
+    }
+    if (release)
+      Clear();
+
+    return scope.Escape(result);
+  }
+
+}  // namespace nkit
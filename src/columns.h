@@ -0,0 +1,89 @@
+/*
+   Copyright 2014 Boris T. Darchiev (boris.darchiev@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <map>
+#include <string>
+
+#include <nan.h>
+
+#include "nkit/dynamic.h"
+
+namespace nkit
+{
+  //----------------------------------------------------------------------------
+  // One column of "columnar" result. Numbers are kept in growable native
+  // buffer, which becomes backing store of Float64Array without copying.
+  // As soon as column gets non-number value, it is converted to list.
+  // Only one thread at a time may use column.
+  class Column: Uncopyable
+  {
+  public:
+    typedef NKIT_SHARED_PTR(Column) Ptr;
+
+    Column();
+    ~Column();
+
+    // Adds missing values (NaN or undefined) until column has 'size' values
+    void Pad(size_t size);
+    void Append(const Dynamic & value);
+    void Clear();
+
+    size_t size() const { return size_; }
+
+    // If 'release' is true, native buffer is passed to V8 and column
+    // becomes empty
+    v8::Local<v8::Value> ToV8(bool release);
+
+  private:
+    void ConvertToList();
+
+    double * numbers_;
+    size_t size_;
+    size_t capacity_;
+    bool numeric_;
+    Dynamic values_;
+  };
+
+  //----------------------------------------------------------------------------
+  // Columns of one list mapping: records (objects) are split by keys.
+  // Items of list of scalars go to the single column.
+  class Columns: Uncopyable
+  {
+    typedef std::map<std::string, Column::Ptr> ColumnMap;
+
+  public:
+    typedef NKIT_SHARED_PTR(Columns) Ptr;
+
+    Columns();
+
+    void Append(const Dynamic & item);
+    void Clear();
+
+    v8::Local<v8::Value> ToV8(bool release);
+
+  private:
+    size_t count_;
+    bool scalars_;
+    Column values_;
+    ColumnMap columns_;
+  };
+
+}  // namespace nkit
+
+#endif // COLUMNS_H
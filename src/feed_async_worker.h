@@ -0,0 +1,112 @@
+/*
+   Copyright 2014 Boris T. Darchiev (boris.darchiev@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef FEED_ASYNC_WORKER_H
+#define FEED_ASYNC_WORKER_H
+
+#include <string>
+
+#include <node_buffer.h>
+#include <nan.h>
+
+namespace nkit
+{
+  //----------------------------------------------------------------------------
+  // Feeds one chunk to the wrapper's native (Dynamic-based) builder on
+  // the libuv thread pool. Only Expat and the native builder are touched
+  // in Execute(); all V8 work happens in the callbacks on the main thread.
+  // W must provide:
+  //   async_builder_  - builder with Feed(data, len, last, error),
+  //                     SetSuspendInterval(elements) and finished() methods
+  //   busy_           - flag, set by caller before queueing
+  //   EmitItems(true) - passes records, collected during parsing,
+  //                     to JavaScript callbacks
+  //   AsyncResult()   - converts finished native result to V8 value
+  template <typename W>
+  class FeedAsyncWorker: public Nan::AsyncWorker
+  {
+  public:
+    FeedAsyncWorker(Nan::Callback * callback, W * wrapper,
+        v8::Local<v8::Object> self, v8::Local<v8::Value> chunk, bool last)
+      : Nan::AsyncWorker(callback)
+      , wrapper_(wrapper)
+      , data_(NULL)
+      , length_(0)
+      , last_(last)
+    {
+      SaveToPersistent("self", self);
+      if (node::Buffer::HasInstance(chunk))
+      {
+        // Buffer memory is not moved by GC, so keeping a reference
+        // to Buffer object is enough to use its data in another thread
+        v8::Local<v8::Object> buffer = v8::Local<v8::Object>::Cast(chunk);
+        SaveToPersistent("chunk", buffer);
+        data_ = node::Buffer::Data(buffer);
+        length_ = node::Buffer::Length(buffer);
+      }
+      else if (chunk->IsString())
+      {
+        v8::String::Utf8Value utf8_value(chunk);
+        string_chunk_.assign(*utf8_value, utf8_value.length());
+        data_ = string_chunk_.data();
+        length_ = string_chunk_.size();
+      }
+    }
+
+    void Execute()
+    {
+      std::string error;
+      // interval may be left by previous feed() in the main thread:
+      // suspended parser in thread pool would drop the rest of chunk
+      wrapper_->async_builder_->SetSuspendInterval(0);
+      if (!wrapper_->async_builder_->Feed(data_, length_, last_, &error))
+        SetErrorMessage(error.c_str());
+    }
+
+  protected:
+    void HandleOKCallback()
+    {
+      Nan::HandleScope scope;
+      wrapper_->EmitItems(true);
+      wrapper_->busy_ = false;
+      v8::Local<v8::Value> result;
+      if (last_)
+        result = wrapper_->AsyncResult();
+      else
+        result = Nan::New(wrapper_->async_builder_->finished());
+      v8::Local<v8::Value> argv[2] = { Nan::Null(), result };
+      callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback()
+    {
+      Nan::HandleScope scope;
+      wrapper_->EmitItems(true);
+      wrapper_->busy_ = false;
+      Nan::AsyncWorker::HandleErrorCallback();
+    }
+
+  private:
+    W * wrapper_;
+    std::string string_chunk_;
+    const char * data_;
+    size_t length_;
+    bool last_;
+  };
+
+}  // namespace nkit
+
+#endif // FEED_ASYNC_WORKER_H
@@ -26,6 +26,7 @@ namespace nkit
 
   void InitModule(Handle<Object> exports)
   {
+    CompiledMappingWrapper::Init(exports);
     Xml2VarBuilderWrapper::Init(exports);
     AnyXml2VarBuilderWrapper::Init(exports);
     nkit::V8BuilderPolicy::Init();
@@ -0,0 +1,375 @@
+/*
+   Copyright 2014 Boris T. Darchiev (boris.darchiev@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef PARALLEL_PARSE_WORKER_H
+#define PARALLEL_PARSE_WORKER_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <node_buffer.h>
+#include <nan.h>
+
+#include "nkit/dynamic.h"
+
+namespace nkit
+{
+  //----------------------------------------------------------------------------
+  // Segments are not made smaller than this, so small documents are parsed
+  // by one thread
+  static const size_t MIN_PARALLEL_SEGMENT_SIZE = 64 * 1024;
+
+  //----------------------------------------------------------------------------
+  // Number of CPUs (at least 1)
+  inline size_t cpu_count()
+  {
+    uv_cpu_info_t * cpus = NULL;
+    int count = 0;
+#if NODE_MODULE_VERSION >= NODE_0_12_MODULE_VERSION
+    if (uv_cpu_info(&cpus, &count) != 0)
+      return 1;
+#else
+    if (uv_cpu_info(&cpus, &count).code != UV_OK)
+      return 1;
+#endif
+    uv_free_cpu_info(cpus, count);
+    return count > 0 ? static_cast<size_t>(count) : 1;
+  }
+
+  //----------------------------------------------------------------------------
+  inline bool is_xml_space(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+  }
+
+  //----------------------------------------------------------------------------
+  // Skips XML declaration, processing instructions, comments and DOCTYPE.
+  // Returns position after start tag of root element (or NULL, if root
+  // element is not found or is empty), fills XML declaration (it is needed
+  // for encoding of segments) and root element name.
+  inline const char * parse_xml_prolog(const char * begin, const char * end,
+      std::string * declaration, std::string * root_name)
+  {
+    static const char BOM[] = "\xEF\xBB\xBF";
+    const char * p = begin;
+    if (end - p >= 3 && memcmp(p, BOM, 3) == 0)
+      p += 3;
+
+    while (true)
+    {
+      p = std::find(p, end, '<');
+      if (end - p < 2)
+        return NULL;
+
+      const char * close = NULL;
+      if (p[1] == '?')
+      {
+        static const char PI_END[] = "?>";
+        close = std::search(p, end, PI_END, PI_END + 2);
+        if (close != end && p - begin <= 3 && end - p > 5
+            && memcmp(p, "<?xml", 5) == 0 && is_xml_space(p[5]))
+          declaration->assign(p, close + 2);
+        close += close != end ? 2 : 0;
+      }
+      else if (end - p >= 4 && memcmp(p, "<!--", 4) == 0)
+      {
+        static const char COMMENT_END[] = "-->";
+        close = std::search(p, end, COMMENT_END, COMMENT_END + 3);
+        close += close != end ? 3 : 0;
+      }
+      else if (p[1] == '!')
+      {
+        // DOCTYPE, possibly with internal subset in brackets
+        const char * bracket = std::find(p, end, '[');
+        close = std::find(p, end, '>');
+        if (bracket < close)
+          close = std::find(std::find(bracket, end, ']'), end, '>');
+        close += close != end ? 1 : 0;
+      }
+      else
+      {
+        const char * name_end = p + 1;
+        while (name_end != end && !is_xml_space(*name_end)
+            && *name_end != '>' && *name_end != '/')
+          ++name_end;
+        root_name->assign(p + 1, name_end);
+
+        // attribute values may contain '>'
+        char quote = 0;
+        for (p = name_end; p != end; ++p)
+        {
+          if (quote)
+            quote = *p == quote ? 0 : quote;
+          else if (*p == '"' || *p == '\'')
+            quote = *p;
+          else if (*p == '>')
+            return *(p - 1) == '/' ? NULL : p + 1;
+        }
+        return NULL;
+      }
+
+      if (close == end)
+        return NULL;
+      p = close;
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  // Returns position of the next start tag of record element
+  // ('tag' is "<" + element name), or 'end'
+  inline const char * find_record(const char * from, const char * end,
+      const std::string & tag)
+  {
+    while (true)
+    {
+      const char * found = std::search(from, end, tag.begin(), tag.end());
+      if (found == end)
+        return end;
+      const char * after = found + tag.size();
+      if (after != end && (is_xml_space(*after) || *after == '>'
+          || *after == '/'))
+        return found;
+      from = after;
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  // Parses one document by several threads. Document is split before start
+  // tags of record elements (children of root element, which are parsed by
+  // list mappings), and each segment is parsed by its own native builder.
+  // Segments, which don't contain root start or end tag, get synthesized
+  // ones (together with XML declaration of document). Lists of segments
+  // are concatenated in document order.
+  // Bounds are found by plain search of record start tag, so they may
+  // fall into nested element with the same name, comment or CDATA section.
+  // Then some segment isn't well-formed (each segment starts at depth 1,
+  // so it's well-formed only if it ends at depth 1 outside of markup),
+  // and the whole document is parsed again by the first builder, which
+  // also reports real errors of document with right line numbers.
+  // Execute() runs on libuv thread pool and starts additional threads
+  // for all segments except the first one; segments, whose threads can't
+  // be started, are parsed by Execute() itself. Segment builders share
+  // mapping plan of the wrapper; they are created and destroyed in the main
+  // thread.
+  // W must provide:
+  //   AsyncBuilder             - native (Dynamic-based) builder type
+  //   plan_                    - mapping plan
+  //   busy_                    - flag, set by caller before queueing
+  //   ParallelResult(result)   - converts dictionary of merged lists
+  //                              to V8 value
+  template <typename W>
+  class ParallelParseWorker: public Nan::AsyncWorker
+  {
+    typedef typename W::AsyncBuilder AsyncBuilder;
+
+    struct Segment
+    {
+      ParallelParseWorker * worker_;
+      const char * begin_;
+      const char * end_;
+      bool has_root_start_;
+      bool has_root_end_;
+      AsyncBuilder * builder_;
+      std::string error_;
+      uv_thread_t thread_;
+      bool started_;
+    };
+
+  public:
+    ParallelParseWorker(Nan::Callback * callback, W * wrapper,
+        v8::Local<v8::Object> self, v8::Local<v8::Value> chunk,
+        const std::string & record_name, size_t threads)
+      : Nan::AsyncWorker(callback)
+      , wrapper_(wrapper)
+      , record_tag_("<" + record_name)
+      , threads_(threads)
+      , data_(NULL)
+      , length_(0)
+    {
+      SaveToPersistent("self", self);
+      if (node::Buffer::HasInstance(chunk))
+      {
+        v8::Local<v8::Object> buffer = v8::Local<v8::Object>::Cast(chunk);
+        SaveToPersistent("chunk", buffer);
+        data_ = node::Buffer::Data(buffer);
+        length_ = node::Buffer::Length(buffer);
+      }
+      else if (chunk->IsString())
+      {
+        v8::String::Utf8Value utf8_value(chunk);
+        string_chunk_.assign(*utf8_value, utf8_value.length());
+        data_ = string_chunk_.data();
+        length_ = string_chunk_.size();
+      }
+
+      size_t count = std::min(threads_,
+          length_ / MIN_PARALLEL_SEGMENT_SIZE + 1);
+      for (size_t i = 0; i < count; ++i)
+        builders_.push_back(AsyncBuilder::Create(wrapper->plan_));
+    }
+
+    void Execute()
+    {
+      Split();
+
+      for (size_t i = 1; i < segments_.size(); ++i)
+        segments_[i].started_ = uv_thread_create(&segments_[i].thread_,
+            &ParallelParseWorker::ParseSegment, &segments_[i]) == 0;
+      ParseSegment(&segments_[0]);
+      for (size_t i = 1; i < segments_.size(); ++i)
+      {
+        if (segments_[i].started_)
+          uv_thread_join(&segments_[i].thread_);
+        else
+          ParseSegment(&segments_[i]);
+      }
+
+      result_ = Dynamic::Dict();
+      for (size_t i = 0; i < segments_.size(); ++i)
+      {
+        if (!segments_[i].error_.empty())
+        {
+          if (segments_.size() == 1 || !ParseWhole())
+          {
+            SetErrorMessage(segments_[0].error_.c_str());
+            return;
+          }
+          break;
+        }
+      }
+
+      StringList mapping_names(segments_[0].builder_->mapping_names());
+      StringList::const_iterator name = mapping_names.begin(),
+          end = mapping_names.end();
+      for (; name != end; ++name)
+      {
+        Dynamic list = Dynamic::List();
+        for (size_t i = 0; i < segments_.size(); ++i)
+          list.Extend(segments_[i].builder_->var(*name));
+        result_[*name] = list;
+      }
+      segments_.clear();
+    }
+
+  protected:
+    void HandleOKCallback()
+    {
+      Nan::HandleScope scope;
+      wrapper_->busy_ = false;
+      v8::Local<v8::Value> argv[2] = { Nan::Null(),
+          wrapper_->ParallelResult(result_) };
+      callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback()
+    {
+      Nan::HandleScope scope;
+      wrapper_->busy_ = false;
+      Nan::AsyncWorker::HandleErrorCallback();
+    }
+
+  private:
+    void Split()
+    {
+      const char * begin = data_, * end = data_ + length_;
+      const char * body = parse_xml_prolog(begin, end, &declaration_,
+          &root_name_);
+
+      size_t count = builders_.size();
+      std::vector<const char *> bounds(1, begin);
+      for (size_t i = 1; body && i < count; ++i)
+      {
+        const char * from = std::max(begin + length_ / count * i,
+            std::max(bounds.back() + 1, body));
+        const char * bound = find_record(from, end, record_tag_);
+        if (bound == end)
+          break;
+        bounds.push_back(bound);
+      }
+      bounds.push_back(end);
+
+      segments_.resize(bounds.size() - 1);
+      for (size_t i = 0; i < segments_.size(); ++i)
+      {
+        Segment & segment = segments_[i];
+        segment.worker_ = this;
+        segment.begin_ = bounds[i];
+        segment.end_ = bounds[i + 1];
+        segment.has_root_start_ = i == 0;
+        segment.has_root_end_ = i == segments_.size() - 1;
+        segment.builder_ = builders_[i].get();
+        segment.started_ = false;
+      }
+    }
+
+    // Parses the whole document as one segment
+    bool ParseWhole()
+    {
+      segments_.resize(1);
+      Segment & segment = segments_[0];
+      segment.end_ = data_ + length_;
+      segment.has_root_end_ = true;
+      segment.error_.clear();
+      segment.builder_->Restart();
+      segment.builder_->Clear();
+      ParseSegment(&segment);
+      return segment.error_.empty();
+    }
+
+    static void ParseSegment(void * data)
+    {
+      Segment * segment = static_cast<Segment *>(data);
+      const ParallelParseWorker * worker = segment->worker_;
+      AsyncBuilder & builder = *segment->builder_;
+      std::string * error = &segment->error_;
+
+      if (!segment->has_root_start_)
+      {
+        std::string start = worker->declaration_ + "<"
+            + worker->root_name_ + ">";
+        if (!builder.Feed(start.data(), start.size(), false, error))
+          return;
+      }
+
+      if (!builder.Feed(segment->begin_, segment->end_ - segment->begin_,
+          segment->has_root_end_, error))
+        return;
+
+      if (!segment->has_root_end_)
+      {
+        std::string end = "</" + worker->root_name_ + ">";
+        builder.Feed(end.data(), end.size(), true, error);
+      }
+    }
+
+    W * wrapper_;
+    std::string record_tag_;
+    size_t threads_;
+    std::string string_chunk_;
+    const char * data_;
+    size_t length_;
+    std::string declaration_;
+    std::string root_name_;
+    std::vector<typename AsyncBuilder::Ptr> builders_;
+    std::vector<Segment> segments_;
+    Dynamic result_;
+  };
+
+}  // namespace nkit
+
+#endif // PARALLEL_PARSE_WORKER_H
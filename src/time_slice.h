@@ -0,0 +1,64 @@
+/*
+   Copyright 2014 Boris T. Darchiev (boris.darchiev@gmail.com)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+#ifndef TIME_SLICE_H
+#define TIME_SLICE_H
+
+#include <algorithm>
+#include <string>
+
+#include <nan.h>
+
+namespace nkit
+{
+  //----------------------------------------------------------------------------
+  // Number of start tags, parsed between checks of "sliceMs" time budget
+  static const size_t ELEMENTS_PER_TIME_CHECK = 1024;
+
+  //----------------------------------------------------------------------------
+  // Converts "sliceMs" option of feed() and resume() to uv_hrtime() based
+  // deadline (0 - no time budget)
+  inline bool get_deadline(v8::Local<v8::Value> options, uint64_t * deadline,
+      std::string * error)
+  {
+    *deadline = 0;
+    if (options->IsUndefined())
+      return true;
+    if (!options->IsObject())
+    {
+      *error = "Options parameter must be Object";
+      return false;
+    }
+
+    v8::Local<v8::Value> slice_ms = Nan::Get(
+        v8::Local<v8::Object>::Cast(options),
+        Nan::New("sliceMs").ToLocalChecked()).ToLocalChecked();
+    if (slice_ms->IsUndefined())
+      return true;
+    if (!slice_ms->IsNumber() || !(slice_ms->NumberValue() > 0.0))
+    {
+      *error = "Option 'sliceMs' must be positive number";
+      return false;
+    }
+    // too big number can't be converted to uint64_t (1e18 ns is 31 years)
+    *deadline = uv_hrtime() + static_cast<uint64_t>(
+        std::min(slice_ms->NumberValue() * 1000000.0, 1e18));
+    return true;
+  }
+
+}  // namespace nkit
+
+#endif // TIME_SLICE_H
@@ -14,6 +14,8 @@
  limitations under the License.
  */
 
+#include <cstring>
+
 #include <node.h>
 #include <nan.h>
 #include "v8_var_policy.h"
@@ -23,22 +25,210 @@ namespace nkit
 {
   using namespace v8;
 
-  Nan::Persistent<v8::Function> V8BuilderPolicy::date_constructor_;
+  V8KeyCache::V8KeyCache(Isolate * isolate)
+    : isolate_(isolate)
+  {}
+
+  V8KeyCache::~V8KeyCache()
+  {
+    for (size_t i = 0; i < ids_.size(); ++i)
+      delete ids_[i];
+    for (size_t i = 0; i < SIZE; ++i)
+      slots_[i].key_.Reset();
+  }
+
+#if NODE_MODULE_VERSION >= NODE_0_12_MODULE_VERSION
+  static uv_once_t key_cache_once = UV_ONCE_INIT;
+  static uv_key_t key_cache_key;
+
+  void V8KeyCache::CreateThreadKey()
+  {
+    uv_key_create(&key_cache_key);
+  }
+
+  // Called when environment of isolate is being destroyed (Node.js 10+)
+  void V8KeyCache::Delete(void * cache)
+  {
+    if (uv_key_get(&key_cache_key) == cache)
+      uv_key_set(&key_cache_key, NULL);
+    delete static_cast<V8KeyCache *>(cache);
+  }
+
+  V8KeyCache & V8KeyCache::Current()
+  {
+    uv_once(&key_cache_once, &V8KeyCache::CreateThreadKey);
+    Isolate * isolate = Isolate::GetCurrent();
+    V8KeyCache * cache = static_cast<V8KeyCache *>(
+        uv_key_get(&key_cache_key));
+    if (likely(cache != NULL && cache->isolate_ == isolate))
+      return *cache;
+
+    // cache of isolate, which was disposed without cleanup, can't release
+    // its handles, so it is left as is
+    cache = new V8KeyCache(isolate);
+    uv_key_set(&key_cache_key, cache);
+#if NODE_MODULE_VERSION >= 64 // Node.js 10
+    node::AtExit(node::GetCurrentEnvironment(isolate->GetCurrentContext()),
+        &V8KeyCache::Delete, cache);
+#endif
+    return *cache;
+  }
+#else
+  // Only one isolate exists
+  V8KeyCache & V8KeyCache::Current()
+  {
+    static V8KeyCache * cache = new V8KeyCache(NULL);
+    return *cache;
+  }
+#endif
+
+  Local<String> V8KeyCache::Find(const DictKey & key)
+  {
+    size_t id = key.id();
+    if (likely(id != DictKey::NO_ID))
+    {
+      if (unlikely(id >= ids_.size()))
+        ids_.resize(id + 1, NULL);
+      if (likely(ids_[id] != NULL))
+        return Nan::New(*ids_[id]);
+      Nan::EscapableHandleScope scope;
+      Local<String> str = NewKey(key.name());
+      ids_[id] = new Nan::Persistent<String>(str);
+      return scope.Escape(str);
+    }
+
+    // FNV-1a
+    const std::string & name = key.name();
+    uint32_t hash = 2166136261u;
+    const char * c = name.data(), * end = c + name.size();
+    for (; c != end; ++c)
+      hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+
+    Slot & slot = slots_[hash % SIZE];
+    if (likely(!slot.key_.IsEmpty() && slot.name_ == name))
+      return Nan::New(slot.key_);
+
+    Nan::EscapableHandleScope scope;
+    Local<String> str = NewKey(name);
+    slot.name_ = name;
+    slot.key_.Reset(str);
+    return scope.Escape(str);
+  }
+
+  Local<String> V8KeyCache::NewKey(const std::string & key)
+  {
+#if defined(V8_MAJOR_VERSION) && (V8_MAJOR_VERSION > 4 ||                      \
+  (V8_MAJOR_VERSION == 4 && defined(V8_MINOR_VERSION) && V8_MINOR_VERSION >= 3))
+    Local<String> str = String::NewFromUtf8(v8::Isolate::GetCurrent(),
+        key.data(), NewStringType::kInternalized,
+        static_cast<int>(key.size())).ToLocalChecked();
+#elif NODE_MODULE_VERSION >= NODE_0_12_MODULE_VERSION
+    Local<String> str = String::NewFromUtf8(v8::Isolate::GetCurrent(),
+        key.data(), String::kInternalizedString,
+        static_cast<int>(key.size()));
+#else
+    Local<String> str = String::NewSymbol(key.data(),
+        static_cast<int>(key.size()));
+#endif
+    return str;
+  }
+
+  //----------------------------------------------------------------------------
+  // Number of days since 1970-01-01 for date of proleptic Gregorian calendar
+  // (month is 1..12). Unlike mktime() it does not depend on timezone
+  // and does not touch global state.
+  static int64_t days_from_civil(int64_t year, int month, int day)
+  {
+    if (month <= 2)
+      --year;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const int64_t year_of_era = year - era * 400;
+    const int64_t day_of_year =
+        (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const int64_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+        year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+  }
+
+  //----------------------------------------------------------------------------
+  static bool parse_digits(const char * & c, size_t count, int min, int max,
+      int * out)
+  {
+    int value = 0;
+    for (size_t i = 0; i < count; ++i, ++c)
+    {
+      if (*c < '0' || *c > '9')
+        return false;
+      value = value * 10 + (*c - '0');
+    }
+    if (value < min || value > max)
+      return false;
+    *out = value;
+    return true;
+  }
+
+  // Hand-written parsing of the most used formats: "%Y-%m-%d",
+  // "%Y-%m-%dT%H:%M:%S" and "%Y-%m-%d %H:%M:%S".
+  // Returns false if format is not one of them or value does not match it
+  // exactly, strptime() is used in this case.
+  static bool fast_strptime(const std::string & value, const char * format,
+      struct tm * _tm)
+  {
+    char time_separator;
+    if (strcmp(format, "%Y-%m-%d") == 0)
+      time_separator = 0;
+    else if (strcmp(format, "%Y-%m-%dT%H:%M:%S") == 0)
+      time_separator = 'T';
+    else if (strcmp(format, "%Y-%m-%d %H:%M:%S") == 0)
+      time_separator = ' ';
+    else
+      return false;
+
+    if (value.size() != (time_separator ? 19 : 10))
+      return false;
+
+    const char * c = value.data();
+    int year, month, day, hour = 0, minute = 0, second = 0;
+    if (!parse_digits(c, 4, 0, 9999, &year) || *c++ != '-' ||
+        !parse_digits(c, 2, 1, 12, &month) || *c++ != '-' ||
+        !parse_digits(c, 2, 1, 31, &day))
+      return false;
+
+    if (time_separator &&
+        (*c++ != time_separator ||
+        !parse_digits(c, 2, 0, 23, &hour) || *c++ != ':' ||
+        !parse_digits(c, 2, 0, 59, &minute) || *c++ != ':' ||
+        !parse_digits(c, 2, 0, 61, &second)))
+      return false;
+
+    _tm->tm_year = year - 1900;
+    _tm->tm_mon = month - 1;
+    _tm->tm_mday = day;
+    _tm->tm_hour = hour;
+    _tm->tm_min = minute;
+    _tm->tm_sec = second;
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  time_t V8BuilderPolicy::tz_offset_ = 0;
   Nan::Persistent<v8::Value> V8BuilderPolicy::undefined_;
 
   void V8BuilderPolicy::Init()
   {
     Nan::HandleScope scope;
 
-    Local<Object> global = Nan::GetCurrentContext()->Global();
-    date_constructor_.Reset(
-            Local<Function>::Cast(
-                    global->Get(Nan::New("Date").ToLocalChecked())));
+    tz_offset_ = nkit::timezone_offset();
     undefined_.Reset(Nan::Undefined());
   }
 
   V8BuilderPolicy::V8BuilderPolicy(const detail::Options & options)
-    : options_(options)
+    : local_handles_(false)
+    , deferred_(false)
+    , pending_size_(0)
+    , last_pending_(0)
+    , local_list_(false)
+    , options_(options)
   {
     Nan::HandleScope scope;
     object_.Reset(Nan::New<Object>());
@@ -48,56 +238,86 @@ namespace nkit
   {
     Nan::HandleScope scope;
     object_.Reset();
-    KeyMap::const_iterator it = keys_.begin(),
-            end = keys_.end();
-    for (; it != end; ++it)
-    {
-      Nan::Persistent<v8::String> * pers_key = it->second;
-      pers_key->Reset();
-      delete pers_key;
-    }
   }
 
+  // Dicts and strings are kept in local handles in local handles mode
+  // (AnyXml2VarBuilder makes them for every element), other values are
+  // always persistent
   void V8BuilderPolicy::InitAsDict()
   {
+    if (local_handles_)
+    {
+      SetLocal(Local<Value>());
+      deferred_ = true;
+      pending_size_ = 0;
+      last_pending_ = 0;
+      return;
+    }
     Nan::HandleScope scope;
-    object_.Reset(Nan::New<Object>());
+    Reset(Nan::New<Object>());
   }
 
+  // In local handles mode items of list are collected natively and array
+  // is made by Persist()
   void V8BuilderPolicy::InitAsList()
   {
+    list_items_.clear();
+    if (local_handles_)
+    {
+      SetLocal(Local<Value>());
+      local_list_ = true;
+      return;
+    }
     Nan::HandleScope scope;
-    object_.Reset(Nan::New<Array>());
+    Reset(Nan::New<Array>());
   }
 
   void V8BuilderPolicy::ListCheck() const
   {
-    assert(Local<Array>::Cast(Nan::New(object_))->IsArray());
+    assert(local_list_ || Local<Array>::Cast(value())->IsArray());
   }
 
   void V8BuilderPolicy::DictCheck() const
   {
-    assert(Local<Object>::Cast(Nan::New(object_))->IsObject());
+    assert(deferred_ || Local<Object>::Cast(value())->IsObject());
   }
 
   void V8BuilderPolicy::InitAsBoolean(bool value)
   {
     Nan::HandleScope scope;
-    object_.Reset(Nan::New(value));
+    Reset(Nan::New(value));
   }
 
-  void V8BuilderPolicy::InitAsString(std::string const & value)
+  void V8BuilderPolicy::InitAsString(const char * value, size_t size)
   {
+    if (local_handles_)
+    {
+      SetLocal(Nan::New(value, static_cast<int>(size)).ToLocalChecked());
+      return;
+    }
     Nan::HandleScope scope;
-    object_.Reset(Nan::New(value).ToLocalChecked());
+    Reset(Nan::New(value, static_cast<int>(size)).ToLocalChecked());
   }
 
-  void V8BuilderPolicy::InitAsInteger(const std::string & value)
+  void V8BuilderPolicy::InitAsInteger(const char * value, size_t size)
   {
-    int32_t i = !value.empty() ? strtol(value.c_str(), NULL, 10) : 0;
+    int64_t i = 0;
+    parse_int64(value, size, &i);
 
     Nan::HandleScope scope;
-    object_.Reset(Nan::New(i));
+    if (unlikely(options_.int64_ && static_cast<int32_t>(i) != i))
+      Reset(Nan::New(static_cast<double>(i)));
+    else
+      Reset(Nan::New(static_cast<int32_t>(i)));
+  }
+
+  void V8BuilderPolicy::InitAsFloat(const char * value, size_t size)
+  {
+    double d(0.0);
+    parse_double(value, size, &d);
+
+    Nan::HandleScope scope;
+    Reset(Nan::New(d));
   }
 
   void V8BuilderPolicy::InitAsFloatFormat(std::string const & value,
@@ -111,7 +331,7 @@ namespace nkit
     }
 
     Nan::HandleScope scope;
-    object_.Reset(Nan::New(d));
+    Reset(Nan::New(d));
   }
 
   void V8BuilderPolicy::InitAsDatetimeFormat(const std::string & value,
@@ -124,113 +344,292 @@ namespace nkit
     struct tm _tm =
     { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 #endif
-    if (NKIT_STRPTIME(value.c_str(), format, &_tm) == NULL)
+    if (!fast_strptime(value, format, &_tm) &&
+        NKIT_STRPTIME(value.c_str(), format, &_tm) == NULL)
     {
       InitAsUndefined();
       return;
     }
 
-    time_t tz_offset = nkit::timezone_offset() / 60;
-    char tz_sign = '-';
-    if (tz_offset < 0)
+    Nan::HandleScope scope;
+    Reset(NewDate(_tm));
+  }
+
+  Local<Value> V8BuilderPolicy::NewDate(const struct tm & _tm)
+  {
+    // struct tm keeps local time, so timezone offset is added to get UTC
+    double seconds = static_cast<double>(days_from_civil(
+        _tm.tm_year + 1900, _tm.tm_mon + 1, _tm.tm_mday)) * 86400.0 +
+        _tm.tm_hour * 3600 + _tm.tm_min * 60 + _tm.tm_sec +
+        static_cast<double>(tz_offset_);
+
+    Nan::EscapableHandleScope scope;
+    return scope.Escape(Nan::New<Date>(seconds * 1000.0).ToLocalChecked());
+  }
+
+  // Open element is persisted with properties, which it has got so far;
+  // the rest ones are set directly
+  void V8BuilderPolicy::Persist()
+  {
+    if (deferred_)
     {
-      tz_offset *= -1;
-      tz_sign = '+';
+      Nan::HandleScope scope;
+      object_.Reset(MakeDict());
+      deferred_ = false;
     }
+    else if (local_list_)
+      PersistList();
+    else if (!local_.IsEmpty())
+    {
+      object_.Reset(local_);
+      local_ = Local<Value>();
+    }
+  }
 
-    char tz_offset_hours[3];
-    sprintf(tz_offset_hours, "%02u",
-        static_cast<uint32_t>(tz_offset / 60));
-    tz_offset_hours[2] = 0;
+  // Array is made at once with its final length. Items, collected after
+  // that (e.g. in the next chunk), are appended at its current length:
+  // JavaScript code may change it (builder.get() and splice()).
+  void V8BuilderPolicy::PersistList()
+  {
+    Nan::HandleScope scope;
+    uint32_t count = static_cast<uint32_t>(list_items_.size());
+    if (object_.IsEmpty())
+    {
+      Local<Array> arr = Nan::New<Array>(static_cast<int>(count));
+      for (uint32_t i = 0; i < count; ++i)
+        Nan::Set(arr, i, list_items_[i]);
+      object_.Reset(arr);
+    }
+    else if (count != 0)
+    {
+      Local<Array> arr = Local<Array>::Cast(Nan::New(object_));
+      uint32_t length = arr->Length();
+      for (uint32_t i = 0; i < count; ++i)
+        Nan::Set(arr, length + i, list_items_[i]);
+    }
+    list_items_.clear();
+  }
 
-    char tz_offset_minutes[3];
-    sprintf(tz_offset_minutes, "%02u",
-        static_cast<uint32_t>(tz_offset % 60));
-    tz_offset_minutes[2] = 0;
+  // Deferred dict is made anew on every call, so it is called once: when
+  // value of element is passed to its parent
+  Local<Value> V8BuilderPolicy::value() const
+  {
+    if (deferred_)
+      return MakeDict();
+    if (!local_.IsEmpty())
+      return local_;
+    return Nan::New(object_);
+  }
 
-    static const char * WEEK_DAYS[7] =
-    { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-    static const char * MONTHS[12] =
-    { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct",
-        "Nov", "Dec" };
-    static const size_t DATE_TIME_BUFFER_LENGTH = 32;
-    char date_time_buf[DATE_TIME_BUFFER_LENGTH];
-    strftime(date_time_buf, DATE_TIME_BUFFER_LENGTH,
-        "WWW, %d MMM %Y %H:%M:%S ZHHMM", &_tm);
+  Local<Object> V8BuilderPolicy::MakeDict() const
+  {
+    Local<Object> obj = Nan::New<Object>();
+    for (size_t i = 0; i < pending_size_; ++i)
+    {
+      const PendingKey & key = pending_[i];
+      if (key.array_)
+      {
+        Local<Array> arr = Nan::New<Array>(static_cast<int>(
+            key.values_.size()));
+        for (size_t j = 0; j < key.values_.size(); ++j)
+          Nan::Set(arr, static_cast<uint32_t>(j), key.values_[j]);
+        obj->Set(V8KeyCache::Get(DictKey(key.name_, key.id_)), arr);
+      }
+      else
+        obj->Set(V8KeyCache::Get(DictKey(key.name_, key.id_)),
+            key.values_[0]);
+    }
+    return obj;
+  }
 
-    strncpy(date_time_buf, WEEK_DAYS[_tm.tm_wday], 3);
-    strncpy(date_time_buf + 8, MONTHS[_tm.tm_mon], 3);
-    strncpy(date_time_buf + 26, &tz_sign, 1);
-    strncpy(date_time_buf + 27, tz_offset_hours, 2);
-    strncpy(date_time_buf + 29, tz_offset_minutes, 2);
+  // Keys with ids are compared by ids, but key from data may be equal
+  // to key with id
+  static bool same_key(const std::string & name, size_t id,
+      const DictKey & key)
+  {
+    if (id != DictKey::NO_ID && key.id() != DictKey::NO_ID)
+      return id == key.id();
+    return name == key.name();
+  }
 
-    Nan::HandleScope scope;
-    Local<Value> argv[1] = {
-        Nan::New<String>(std::string(date_time_buf, DATE_TIME_BUFFER_LENGTH)).
-          ToLocalChecked()
-    };
-    object_.Reset(
-        Nan::New(date_constructor_)->NewInstance(1, argv));
+  // Same semantics as SetDictKeyValue() ('append' is false) and
+  // AppendToDictKeyList() for V8 object
+  void V8BuilderPolicy::AddPending(const DictKey & name,
+      Local<Value> var, bool append)
+  {
+    if (last_pending_ >= pending_size_ || !same_key(
+        pending_[last_pending_].name_, pending_[last_pending_].id_, name))
+    {
+      last_pending_ = 0;
+      while (last_pending_ < pending_size_ && !same_key(
+          pending_[last_pending_].name_, pending_[last_pending_].id_, name))
+        ++last_pending_;
+    }
+
+    if (last_pending_ == pending_size_)
+    {
+      if (pending_size_ == pending_.size())
+        pending_.resize(pending_size_ + 1);
+      PendingKey & key = pending_[pending_size_++];
+      key.name_ = name.name();
+      key.id_ = name.id();
+      key.values_.assign(1, var);
+      key.array_ = append && options_.explicit_array_;
+      return;
+    }
+
+    PendingKey & key = pending_[last_pending_];
+    if (!append)
+    {
+      key.values_.assign(1, var);
+      key.array_ = false;
+    }
+    else if (!key.array_ && key.values_[0]->IsArray())
+    {
+      Local<Array> arr = Local<Array>::Cast(key.values_[0]);
+      Nan::Set(arr, arr->Length(), var);
+    }
+    else
+    {
+      key.values_.push_back(var);
+      key.array_ = true;
+    }
+  }
+
+  // 'value' must belong to the caller's scope
+  void V8BuilderPolicy::SetLocal(Local<Value> value)
+  {
+    deferred_ = false;
+    local_list_ = false;
+    local_ = value;
+    if (!object_.IsEmpty())
+      object_.Reset();
+  }
+
+  void V8BuilderPolicy::Reset(Local<Value> value)
+  {
+    deferred_ = false;
+    local_list_ = false;
+    local_ = Local<Value>();
+    object_.Reset(value);
   }
 
   void V8BuilderPolicy::InitAsUndefined()
   {
     Nan::HandleScope scope;
-    object_.Reset(Nan::Undefined());
+    Reset(Nan::Undefined());
   }
 
-  void V8BuilderPolicy::SetDictKeyValue(std::string const & key,
+  // Values of deferred dict are kept in the caller's scope, so no
+  // HandleScope is opened for them
+  void V8BuilderPolicy::SetDictKeyValue(const DictKey & key,
       type const & var)
   {
+    if (deferred_)
+    {
+      SetDictKeyValue(key, Nan::New(var));
+      return;
+    }
+    Nan::HandleScope scope;
+    SetDictKeyValue(key, Nan::New(var));
+  }
+
+  void V8BuilderPolicy::SetDictKeyValue(const DictKey & key,
+      const V8BuilderPolicy & var)
+  {
+    if (deferred_)
+    {
+      SetDictKeyValue(key, var.value());
+      return;
+    }
     Nan::HandleScope scope;
-    Local<Value> object(Nan::New(object_));
+    SetDictKeyValue(key, var.value());
+  }
+
+  void V8BuilderPolicy::SetDictKeyValue(const DictKey & key,
+      Local<Value> var)
+  {
+    if (deferred_)
+    {
+      AddPending(key, var, false);
+      return;
+    }
+
+    Local<Value> object(value());
     assert(object->IsObject());
     Local<Object> obj = Local<Object>::Cast(object);
     assert(obj->IsObject());
-    obj->Set(Nan::New(key).ToLocalChecked(), Nan::New(var));
+    obj->Set(V8KeyCache::Get(key), var);
   }
 
+  // Items of local list are kept in the caller's scope until Persist()
   void V8BuilderPolicy::AppendToList(type const & var)
   {
+    if (local_list_)
+    {
+      list_items_.push_back(Nan::New(var));
+      return;
+    }
     Nan::HandleScope scope;
-    Local<Value> object(Nan::New(object_));
+    Local<Value> object(value());
     assert(object->IsArray());
     Local<Array> arr = Local<Array>::Cast(object);
-    arr->Set(arr->Length(), Nan::New(var));
+    Nan::Set(arr, arr->Length(), Nan::New(var));
   }
 
-  void V8BuilderPolicy::AppendToDictKeyList(std::string const & _key,
-          type const & var)
+  void V8BuilderPolicy::AppendToDictKeyList(const DictKey & key,
+      type const & var)
   {
+    if (deferred_)
+    {
+      AppendToDictKeyList(key, Nan::New(var));
+      return;
+    }
     Nan::HandleScope scope;
-    Local<Value> object(Nan::New(object_));
-    assert(object->IsObject());
-    Local<Object> obj = Local<Object>::Cast(object);
+    AppendToDictKeyList(key, Nan::New(var));
+  }
 
-    KeyMap::const_iterator k_it = keys_.find(_key);
-    if (k_it == keys_.end())
+  void V8BuilderPolicy::AppendToDictKeyList(const DictKey & key,
+      const V8BuilderPolicy & var)
+  {
+    if (deferred_)
     {
-      Nan::Persistent<v8::String> * pers_key =
-              new Nan::Persistent<v8::String>(Nan::New(_key).ToLocalChecked());
-      keys_[_key] = pers_key;
-      k_it = keys_.find(_key);
+      AppendToDictKeyList(key, var.value());
+      return;
     }
-    Local<String> key = Nan::New(*k_it->second);
-//    Local<String> key = Nan::New(_key).ToLocalChecked();
+    Nan::HandleScope scope;
+    AppendToDictKeyList(key, var.value());
+  }
 
-    if (obj->Has(key))
+  void V8BuilderPolicy::AppendToDictKeyList(const DictKey & _key,
+      Local<Value> var)
+  {
+    if (deferred_)
     {
-      Local<Value> value = obj->Get(key);
-      if (value->IsArray())
+      AddPending(_key, var, true);
+      return;
+    }
+
+    Local<Value> object(value());
+    assert(object->IsObject());
+    Local<Object> obj = Local<Object>::Cast(object);
+
+    Local<String> key = V8KeyCache::Get(_key);
+
+    // values are never undefined here, so single Get() replaces Has()
+    Local<Value> current = obj->Get(key);
+    if (!current->IsUndefined())
+    {
+      if (current->IsArray())
       {
-        Local<Array> arr = Local<Array>::Cast(value);
-        arr->Set(arr->Length(), Nan::New(var));
+        Local<Array> arr = Local<Array>::Cast(current);
+        arr->Set(arr->Length(), var);
       }
       else
       {
         Local<Array> arr(Nan::New<Array>());
-        arr->Set(0, value);
-        arr->Set(1, Nan::New(var));
+        arr->Set(0, current);
+        arr->Set(1, var);
         obj->Set(key, arr);
       }
     }
@@ -239,12 +638,12 @@ namespace nkit
       if (options_.explicit_array_)
       {
         Local<Array> arr(Nan::New<Array>());
-        arr->Set(0, Nan::New(var));
+        arr->Set(0, var);
         obj->Set(key, arr);
       }
       else
       {
-        obj->Set(key, Nan::New(var));
+        obj->Set(key, var);
       }
     }
   }
@@ -252,7 +651,7 @@ namespace nkit
   std::string V8BuilderPolicy::ToString() const
   {
     Nan::HandleScope scope;
-    return v8var_to_json(Nan::New(object_));
+    return v8var_to_json(value());
   }
 
   std::string v8var_to_json(const Handle<Value> & var)
@@ -271,4 +670,188 @@ namespace nkit
     return *ascii;
   }
 
+  // Scalars are made in the caller's HandleScope: one scope per container,
+  // not per value
+  static Local<Value> dynamic_scalar_to_v8var(const Dynamic & var,
+      bool int64)
+  {
+    if (var.IsString())
+    {
+      const std::string & str = var.GetConstString();
+      return Nan::New<String>(str.data(),
+          static_cast<int>(str.size())).ToLocalChecked();
+    }
+    else if (var.IsSignedInteger())
+    {
+      int64_t i = var.GetSignedInteger();
+      if (static_cast<int32_t>(i) == i || !int64)
+        return Nan::New(static_cast<int32_t>(i));
+      return Nan::New(static_cast<double>(i));
+    }
+    else if (var.IsUnsignedInteger())
+    {
+      uint64_t i = var.GetUnsignedInteger();
+      if (static_cast<uint32_t>(i) == i)
+        return Nan::New(static_cast<uint32_t>(i));
+      return Nan::New(static_cast<double>(i));
+    }
+    else if (var.IsFloat())
+      return Nan::New(var.GetFloat());
+    else if (var.IsBool())
+      return Nan::New(var.GetBoolean());
+    else if (var.IsDateTime())
+    {
+      struct tm _tm;
+      memset(&_tm, 0, sizeof(_tm));
+      _tm.tm_year = var.year() - 1900;
+      _tm.tm_mon = var.month() - 1;
+      _tm.tm_mday = var.day();
+      _tm.tm_hour = var.hours();
+      _tm.tm_min = var.minutes();
+      _tm.tm_sec = var.seconds();
+      return V8BuilderPolicy::NewDate(_tm);
+    }
+    else if (var.IsUndef() || var.IsNone())
+      return Nan::Undefined();
+
+    return Nan::New(var.GetString()).ToLocalChecked();
+  }
+
+  // Keys of objects are taken from V8KeyCache: records of native results
+  // usually have the same keys
+  Local<Value> dynamic_to_v8var(const Dynamic & var, bool int64)
+  {
+    if (var.IsDict())
+    {
+      Nan::EscapableHandleScope scope;
+      Local<Object> obj = Nan::New<Object>();
+      Dynamic::DictConstIterator it = var.begin_d(), end = var.end_d();
+      for (; it != end; ++it)
+        Nan::Set(obj, V8KeyCache::Get(it->first),
+            dynamic_to_v8var(it->second, int64));
+      return scope.Escape(obj);
+    }
+    else if (var.IsList())
+    {
+      Nan::EscapableHandleScope scope;
+      Local<Array> arr = Nan::New<Array>(static_cast<int>(var.size()));
+      Dynamic::ListConstIterator it = var.begin_l(), end = var.end_l();
+      for (uint32_t i = 0; it != end; ++it, ++i)
+        Nan::Set(arr, i, dynamic_to_v8var(*it, int64));
+      return scope.Escape(arr);
+    }
+
+    return dynamic_scalar_to_v8var(var, int64);
+  }
+
+  //----------------------------------------------------------------------------
+  // Follows JSON.stringify() rules: undefined values and functions
+  // in objects are skipped, in arrays they become null
+  static const size_t V8VAR_MAX_DEPTH = 512;
+
+  static bool v8var_to_dynamic(const Local<Value> & var, Dynamic * out,
+      size_t depth, std::string * error)
+  {
+    if (unlikely(depth > V8VAR_MAX_DEPTH))
+    {
+      *error = "Object is too deep or has circular references";
+      return false;
+    }
+
+    if (var->IsString() || var->IsStringObject())
+    {
+      String::Utf8Value utf8_value(var);
+      *out = Dynamic(*utf8_value, utf8_value.length());
+    }
+    else if (var->IsBoolean() || var->IsBooleanObject())
+      *out = Dynamic(Nan::To<bool>(var).FromJust());
+    else if (var->IsInt32())
+      *out = Dynamic(static_cast<int64_t>(Nan::To<int32_t>(var).FromJust()));
+    else if (var->IsNumber() || var->IsNumberObject())
+    {
+      double d;
+      if (!Nan::To<double>(var).To(&d))
+        return false;
+      // integral numbers are integers in JSON too; NaN, infinities and
+      // numbers out of int64 range (cast is undefined for them) stay double
+      static const double INT64_BOUND = 9223372036854775808.0; // 2^63
+      if (d >= -INT64_BOUND && d < INT64_BOUND
+          && d == static_cast<double>(static_cast<int64_t>(d)))
+        *out = Dynamic(static_cast<int64_t>(d));
+      else
+        *out = Dynamic(d);
+    }
+    else if (var->IsDate())
+    {
+      double ms;
+      if (!Nan::To<double>(var).To(&ms))
+        return false;
+      *out = Dynamic::DateTimeFromTimestamp(static_cast<time_t>(ms / 1000));
+    }
+    else if (var->IsArray())
+    {
+      Nan::HandleScope scope;
+      Local<Array> arr = Local<Array>::Cast(var);
+      *out = Dynamic::List();
+      uint32_t length = arr->Length();
+      for (uint32_t i = 0; i < length; ++i)
+      {
+        Local<Value> item;
+        if (!Nan::Get(arr, i).ToLocal(&item))
+          return false;
+        Dynamic value;
+        if (item->IsUndefined() || item->IsFunction())
+          value = Dynamic::None();
+        else if (!v8var_to_dynamic(item, &value, depth + 1, error))
+          return false;
+        out->PushBack(value);
+      }
+    }
+    else if (var->IsFunction() || var->IsUndefined())
+      *out = Dynamic();
+    else if (var->IsObject())
+    {
+      Nan::HandleScope scope;
+      Local<Object> obj = Local<Object>::Cast(var);
+      Local<Array> keys;
+      if (!Nan::GetOwnPropertyNames(obj).ToLocal(&keys))
+        return false;
+      *out = Dynamic::Dict();
+      uint32_t length = keys->Length();
+      for (uint32_t i = 0; i < length; ++i)
+      {
+        Local<Value> key, item;
+        if (!Nan::Get(keys, i).ToLocal(&key)
+            || !Nan::Get(obj, key).ToLocal(&item))
+          return false;
+        if (item->IsUndefined() || item->IsFunction())
+          continue;
+        Dynamic value;
+        if (!v8var_to_dynamic(item, &value, depth + 1, error))
+          return false;
+        String::Utf8Value utf8_key(key);
+        (*out)[std::string(*utf8_key, utf8_key.length())] = value;
+      }
+    }
+    else
+      *out = Dynamic::None();
+
+    return true;
+  }
+
+  // Exceptions of getters and proxies are returned as errors
+  bool v8var_to_dynamic(const Local<Value> & var, Dynamic * out,
+      std::string * error)
+  {
+    Nan::TryCatch try_catch;
+    if (v8var_to_dynamic(var, out, 0, error))
+      return true;
+    if (try_catch.HasCaught())
+    {
+      String::Utf8Value message(try_catch.Exception());
+      *error = *message ? *message : "Exception while reading object";
+    }
+    return false;
+  }
+
 } // namespace vx
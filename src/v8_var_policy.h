@@ -18,6 +18,7 @@
 #define VX_V8_VAR_BUILDER_H
 
 #include <string>
+#include <vector>
 
 #include "nkit/tools.h"
 #include "nkit/xml2var.h"
@@ -26,15 +27,62 @@
 namespace nkit
 {
   std::string v8var_to_json(const v8::Handle<v8::Value> & var);
+  // If 'int64' is false, integers are truncated to 32 bits, like values of
+  // "integer" sub-mappings with "int64" option off
+  v8::Local<v8::Value> dynamic_to_v8var(const Dynamic & var,
+      bool int64 = true);
+  bool v8var_to_dynamic(const v8::Local<v8::Value> & var, Dynamic * out,
+      std::string * error);
+
+  //----------------------------------------------------------------------------
+  // Internalized V8 strings for object keys, shared by all builders of
+  // isolate. Keys with DictKey ids (keys of mappings, "attrkey", "textkey")
+  // are taken from array by id. Other keys are direct-mapped by hash:
+  // memory stays bounded even if keys are taken from data (e.g. attribute
+  // values), a collision just replaces the slot.
+  class V8KeyCache: Uncopyable
+  {
+  public:
+    static v8::Local<v8::String> Get(const DictKey & key)
+    {
+      return Current().Find(key);
+    }
+
+  private:
+    static const size_t SIZE = 1024;
+
+    struct Slot
+    {
+      std::string name_;
+      Nan::Persistent<v8::String> key_;
+    };
+
+    explicit V8KeyCache(v8::Isolate * isolate);
+    ~V8KeyCache();
 
+    // Cache of the current isolate: Node.js runs every isolate (main one
+    // and ones of worker threads) in its own thread, so cache is kept in
+    // thread local storage
+    static V8KeyCache & Current();
+    static void CreateThreadKey();
+    static void Delete(void * cache);
+    static v8::Local<v8::String> NewKey(const std::string & name);
+
+    v8::Local<v8::String> Find(const DictKey & key);
+
+    v8::Isolate * isolate_;
+    std::vector<Nan::Persistent<v8::String> *> ids_;
+    Slot slots_[SIZE];
+  };
+
+  //----------------------------------------------------------------------------
   class V8BuilderPolicy: Uncopyable
   {
-    typedef std::map<std::string, Nan::Persistent<v8::String> * > KeyMap;
-
   public:
     typedef Nan::Persistent<v8::Value> type;
 
     static void Init();
+    static v8::Local<v8::Value> NewDate(const struct tm & _tm);
 
     V8BuilderPolicy(const detail::Options & options);
     ~V8BuilderPolicy();
@@ -47,16 +95,31 @@ namespace nkit
     void InitAsDict();
     void InitAsList();
     void InitAsBoolean(bool value);
-    void InitAsString(std::string const & value);
-    void InitAsInteger(const std::string & value);
+    void InitAsString(const char * value, size_t size);
+    void InitAsInteger(const char * value, size_t size);
+    void InitAsFloat(const char * value, size_t size);
     void InitAsFloatFormat(std::string const & value,
         const char * format);
     void InitAsDatetimeFormat(const std::string & value,
         const char * format);
     void InitAsUndefined();
-    void SetDictKeyValue(std::string const & key, type const & var);
+    void SetDictKeyValue(const DictKey & key, type const & var);
+    void SetDictKeyValue(const DictKey & key,
+        const V8BuilderPolicy & var);
     void AppendToList(type const & obj);
-    void AppendToDictKeyList(std::string const & key, type const & var);
+    void AppendToDictKeyList(const DictKey & key, type const & var);
+    void AppendToDictKeyList(const DictKey & key,
+        const V8BuilderPolicy & var);
+
+    // With local handles value is kept as local handle of the caller's
+    // HandleScope, so no global handle is created and destroyed for it.
+    // Dict is not made until its value is needed: its properties are
+    // collected natively (see PendingKey); items of list are collected
+    // natively too, until Persist() makes array.
+    // Persist() must be called before the scope is closed, if value is
+    // still needed; get() is valid only after Persist().
+    void UseLocalHandles(bool use) { local_handles_ = use; }
+    void Persist();
 
     const type & get() const { return object_; }
     std::string ToString() const;
@@ -64,10 +127,43 @@ namespace nkit
     void DictCheck() const;
 
   private:
+    // Property of dict in local handles mode: one value or items of array
+    struct PendingKey
+    {
+      std::string name_;
+      size_t id_;
+      std::vector<v8::Local<v8::Value> > values_;
+      bool array_;
+    };
+
+    v8::Local<v8::Value> value() const;
+    v8::Local<v8::Object> MakeDict() const;
+    void PersistList();
+    void AddPending(const DictKey & key, v8::Local<v8::Value> var,
+        bool append);
+    void SetDictKeyValue(const DictKey & key, v8::Local<v8::Value> var);
+    void AppendToDictKeyList(const DictKey & key,
+        v8::Local<v8::Value> var);
+    void SetLocal(v8::Local<v8::Value> value);
+    void Reset(v8::Local<v8::Value> value);
+
     type object_;
+    // value in local handles mode (empty after Persist())
+    v8::Local<v8::Value> local_;
+    bool local_handles_;
+    // dict is not made yet, its properties are pending_[0..pending_size_)
+    bool deferred_;
+    std::vector<PendingKey> pending_;
+    size_t pending_size_;
+    // index of the last used pending key: children with the same name
+    // usually go one after another
+    size_t last_pending_;
+    // list in local handles mode: items, which are not in object_ yet
+    bool local_list_;
+    std::vector<v8::Local<v8::Value> > list_items_;
     const detail::Options & options_;
-    KeyMap keys_;
-    static Nan::Persistent<v8::Function> date_constructor_;
+    // seconds west of UTC, cached at module initialization
+    static time_t tz_offset_;
     static Nan::Persistent<v8::Value> undefined_;
   };
 
@@ -19,6 +19,7 @@
 #include <node_buffer.h>
 
 #include "xml2var_builder_wrapper.h"
+#include "time_slice.h"
 
 #include "nkit/xml2var.h"
 #include "nkit/var2xml.h"
@@ -41,24 +42,38 @@ namespace nkit
   #endif
   }
 
+  //----------------------------------------------------------------------------
+  // Default "high_water_mark": items of onItem() callbacks are kept only
+  // by portions, whatever size of chunk is
+  static const size_t DEFAULT_HIGH_WATER_MARK = 16;
+
+  //----------------------------------------------------------------------------
+  // Default number of threads for parseParallelAsync()
+  static const size_t DEFAULT_PARALLEL_THREADS = 4;
+
   //----------------------------------------------------------------------------
   template <typename T>
-  bool parse_object(const T & arg, std::string * out)
+  bool parse_object(const T & arg, const char * name, Dynamic * out,
+      std::string * error)
   {
     if (node::Buffer::HasInstance(arg))
     {
       char* data;
       size_t length;
       get_buffer_data(arg, &data, &length);
-      out->assign(data, length);
+      *out = DynamicFromJson(std::string(data, length), error);
+      return !out->IsUndef();
     }
     else if (arg->IsString())
-      out->assign(*String::Utf8Value(arg));
+    {
+      *out = DynamicFromJson(*String::Utf8Value(arg), error);
+      return !out->IsUndef();
+    }
     else if (arg->IsObject())
-      out->assign(v8var_to_json(arg));
-    else
-      return false;
-    return true;
+      return v8var_to_dynamic(arg, out, error);
+
+    *error = std::string(name) + " parameter must be JSON-string or Object";
+    return false;
   }
 
   //----------------------------------------------------------------------------
@@ -66,24 +81,19 @@ namespace nkit
   {
     Nan::HandleScope scope;
 
-    std::string options("{}");
+    Dynamic op = Dynamic::Dict();
+    std::string ret, error;
     if (1 > info.Length())
       return Nan::ThrowError("Expected JavaScript structure"
           " and/or options object");
     else if (2 <= info.Length())
     {
-      if (!parse_object(info[1], &options))
+      if (!parse_object(info[1], "Options", &op, &error) || !op.IsDict())
         return Nan::ThrowError(
             "Options parameter must be JSON-string or Object");
     }
 
-    std::string ret, error;
-
-    Dynamic op = DynamicFromJson(options, &error);
-    if (!op.IsDict())
-      return Nan::ThrowError("Options parameter must be JSON-string or Object");
-
-    if (!V8ToXmlConverter::Process(options, info[0], &ret, &error))
+    if (!V8ToXmlConverter::Process(op, info[0], &ret, &error))
       return Nan::ThrowError(error.c_str());
 
     Dynamic * as_buffer;
@@ -113,6 +123,18 @@ namespace nkit
     Nan::SetPrototypeMethod(tpl, "feed", Xml2VarBuilderWrapper::Feed);
     Nan::SetPrototypeMethod(tpl, "end", Xml2VarBuilderWrapper::End);
     Nan::SetPrototypeMethod(tpl, "get", Xml2VarBuilderWrapper::Get);
+    Nan::SetPrototypeMethod(tpl, "feedAsync", Xml2VarBuilderWrapper::FeedAsync);
+    Nan::SetPrototypeMethod(tpl, "endAsync", Xml2VarBuilderWrapper::EndAsync);
+    Nan::SetPrototypeMethod(tpl, "onItem",
+        Xml2VarBuilderWrapper::SetItemCallback);
+    Nan::SetPrototypeMethod(tpl, "reset", Xml2VarBuilderWrapper::Reset);
+    Nan::SetPrototypeMethod(tpl, "pause", Xml2VarBuilderWrapper::Pause);
+    Nan::SetPrototypeMethod(tpl, "resume", Xml2VarBuilderWrapper::Resume);
+    Nan::SetPrototypeMethod(tpl, "isPaused", Xml2VarBuilderWrapper::IsPaused);
+    Nan::SetPrototypeMethod(tpl, "isSuspended",
+        Xml2VarBuilderWrapper::IsSuspended);
+    Nan::SetPrototypeMethod(tpl, "parseParallelAsync",
+        Xml2VarBuilderWrapper::ParseParallelAsync);
     constructor.Reset(tpl->GetFunction());
     exports->Set(Nan::New("Xml2VarBuilder").ToLocalChecked(),
         tpl->GetFunction());
@@ -121,6 +143,87 @@ namespace nkit
 
   }
 
+  //----------------------------------------------------------------------------
+  // Parses (mappings) or (options, mappings) arguments
+  bool parse_mapping_arguments(Nan::NAN_METHOD_ARGS_TYPE info,
+      Dynamic * options, Dynamic * mappings, std::string * error)
+  {
+    *options = Dynamic::Dict();
+    if (1 > info.Length())
+    {
+      *error = "Expected one or two arguments:"
+          " 1) mappings or 2) options and mappings";
+      return false;
+    }
+    else if (1 == info.Length())
+      return parse_object(info[0], "Mappings", mappings, error);
+    else
+      return parse_object(info[0], "Options", options, error)
+          && parse_object(info[1], "Mappings", mappings, error);
+  }
+
+  //----------------------------------------------------------------------------
+  Nan::Persistent<FunctionTemplate> CompiledMappingWrapper::constructor_template;
+  Nan::Persistent<Function> CompiledMappingWrapper::constructor;
+
+  //----------------------------------------------------------------------------
+  void CompiledMappingWrapper::Init(Handle<Object> exports)
+  {
+    Nan::HandleScope scope;
+
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(
+            CompiledMappingWrapper::New);
+    tpl->SetClassName(Nan::New("CompiledMapping").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    constructor_template.Reset(tpl);
+    constructor.Reset(tpl->GetFunction());
+    exports->Set(Nan::New("CompiledMapping").ToLocalChecked(),
+        tpl->GetFunction());
+    exports->Set(Nan::New("compileMapping").ToLocalChecked(),
+        Nan::New<FunctionTemplate>(CompiledMappingWrapper::Compile)->
+          GetFunction());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(CompiledMappingWrapper::New)
+  {
+    Nan::HandleScope scope;
+
+    if (!info.IsConstructCall())
+      return Nan::ThrowError("Can't call constructor as a function");
+
+    Dynamic options, mappings;
+    std::string error;
+    if (!parse_mapping_arguments(info, &options, &mappings, &error))
+      return Nan::ThrowError(error.c_str());
+
+    // check and compile mappings once, here
+    Xml2VarPlan::Ptr plan = Xml2VarPlan::Create(options, mappings, &error);
+    if (!plan)
+      return Nan::ThrowError(error.c_str());
+
+    CompiledMappingWrapper* obj = new CompiledMappingWrapper(plan, options,
+        mappings);
+    obj->Wrap(info.This());
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(CompiledMappingWrapper::Compile)
+  {
+    Nan::HandleScope scope;
+
+    const int argc = info.Length() < 2 ? info.Length() : 2;
+    Local<Value> argv[2];
+    for (int i = 0; i < argc; ++i)
+      argv[i] = info[i];
+
+    Nan::MaybeLocal<Object> result = Nan::NewInstance(
+        Nan::New(constructor), argc, argv);
+    if (!result.IsEmpty())
+      info.GetReturnValue().Set(result.ToLocalChecked());
+  }
+
   //----------------------------------------------------------------------------
   NAN_METHOD(Xml2VarBuilderWrapper::New)
   {
@@ -132,34 +235,53 @@ namespace nkit
       return Nan::ThrowError("Can't call constructor as a function");
     }
 
-    std::string options("{}"), mappings;
-    if (1 > info.Length())
-      return Nan::ThrowError("Expected one or two arguments:"
-          " 1) mappings or 2) options and mappings");
-    else if (1 == info.Length())
+    Dynamic options, mappings;
+    Xml2VarPlan::Ptr plan;
+    std::string error;
+    if (1 == info.Length() &&
+        Nan::New(CompiledMappingWrapper::constructor_template)->HasInstance(
+            info[0]))
     {
-      if (!parse_object(info[0], &mappings))
-        return Nan::ThrowError(
-            "Mappings parameter must be JSON-string or Object");
+      CompiledMappingWrapper* compiled =
+          ObjectWrap::Unwrap<CompiledMappingWrapper>(
+              Local<Object>::Cast(info[0]));
+      plan = compiled->plan_;
+      options = compiled->options_;
+      mappings = compiled->mappings_;
     }
     else
     {
-      if (!parse_object(info[0], &options))
-        return Nan::ThrowError(
-            "Options parameter must be JSON-string or Object");
-      if (!parse_object(info[1], &mappings))
-        return Nan::ThrowError(
-            "Mappings parameter must be JSON-string or Object");
+      if (!parse_mapping_arguments(info, &options, &mappings, &error))
+        return Nan::ThrowError(error.c_str());
+      plan = Xml2VarPlan::Create(options, mappings, &error);
+      if (!plan)
+        return Nan::ThrowError(error.c_str());
     }
 
-    std::string error;
-    StructXml2VarBuilder<V8VarBuilder>::Ptr builder =
-        StructXml2VarBuilder<V8VarBuilder>::Create(options, mappings, &error);
+    Dynamic * columnar;
+    bool is_columnar = options.IsDict() && options.Get("columnar", &columnar)
+        && *columnar;
+    Dynamic * native;
+    bool is_native = is_columnar || (options.IsDict()
+        && options.Get("native", &native) && *native);
 
-    if (!builder)
-      return Nan::ThrowError(error.c_str());
+    Dynamic * high_water_mark;
+    size_t max_pending_items = DEFAULT_HIGH_WATER_MARK;
+    if (options.IsDict() && options.Get("high_water_mark", &high_water_mark))
+    {
+      if (!high_water_mark->IsNumber() || high_water_mark->GetFloat() < 1.0)
+        return Nan::ThrowError(
+            "Option 'high_water_mark' must be positive number");
+      max_pending_items = static_cast<size_t>(high_water_mark->GetFloat());
+    }
 
-    Xml2VarBuilderWrapper* obj = new Xml2VarBuilderWrapper(builder);
+    Xml2VarBuilderWrapper* obj = new Xml2VarBuilderWrapper(plan, mappings,
+        is_native, is_columnar, max_pending_items);
+    if (is_native && !obj->CreateNativeBuilder(&error))
+    {
+      delete obj;
+      return Nan::ThrowError(error.c_str());
+    }
     obj->Wrap(info.This());
     info.GetReturnValue().Set(info.This());
   }
@@ -175,29 +297,44 @@ namespace nkit
     Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
         info.This());
 
-    bool result = false;
     std::string error;
+    if (!obj->SetMode(MODE_SYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (!obj->CheckNotSuspended(&error))
+      return Nan::ThrowError(error.c_str());
+
+    uint64_t deadline;
+    if (!get_deadline(info.Length() > 1 ? info[1] : Local<Value>(
+        Nan::Undefined()), &deadline, &error))
+      return Nan::ThrowError(error.c_str());
+
+    bool parsed;
     if (node::Buffer::HasInstance(info[0]))
     {
       char* data;
       size_t length;
       get_buffer_data(info[0], &data, &length);
-
-      result = obj->builder_->Feed(data, length, false, &error);
+      if (!obj->ParseSync(data, length, false, false, deadline, &parsed,
+          &error))
+        return;
     }
     else if (info[0]->IsString())
     {
       String::Utf8Value utf8_value(info[0]);
-      result = obj->builder_->Feed(
-          *utf8_value, utf8_value.length(), false, &error);
+      if (!obj->ParseSync(*utf8_value, utf8_value.length(), false, false,
+          deadline, &parsed, &error))
+        return;
     }
     else
       return Nan::ThrowTypeError("Expected String or Buffer parameter");
 
-    if (!result)
+    if (!parsed)
       return Nan::ThrowError(error.c_str());
 
-    info.GetReturnValue().Set(Nan::Undefined());
+    // true, if all mappings are completed (see "limit" option) and the rest
+    // of document is not needed
+    info.GetReturnValue().Set(Nan::New(obj->finished()));
   }
 
   //----------------------------------------------------------------------------
@@ -211,27 +348,35 @@ namespace nkit
     Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
         info.This());
 
-    Local<Object> result;
-    std::string error;
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    std::string mapping_name;
     if (node::Buffer::HasInstance(info[0]))
     {
       char* str;
       size_t length;
       get_buffer_data(info[0], &str, &length);
-      std::string mapping_name(str, length);
-      result = Local<Object>::Cast(
-          Nan::New<Value>(obj->builder_->var(mapping_name)));
+      mapping_name.assign(str, length);
     }
     else if (info[0]->IsString())
     {
       String::Utf8Value utf8_value(info[0]);
-      std::string mapping_name(*utf8_value, utf8_value.length());
-      result = Local<Object>::Cast(
-          Nan::New<Value>(obj->builder_->var(mapping_name)));
+      mapping_name.assign(*utf8_value, utf8_value.length());
     }
     else
       return Nan::ThrowTypeError("Expected mapping name: String or Buffer");
 
+    Local<Object> result;
+    std::string error;
+    if (obj->mode_ == MODE_ASYNC || obj->native_)
+      result = Local<Object>::Cast(obj->NativeResult(mapping_name, false));
+    else if (!obj->builder_ && !obj->CreateV8Builder(&error))
+      return Nan::ThrowError(error.c_str());
+    else
+      result = Local<Object>::Cast(
+          Nan::New<Value>(obj->builder_->var(mapping_name)));
+
     info.GetReturnValue().Set(result);
   }
 
@@ -245,9 +390,26 @@ namespace nkit
 
     std::string empty = "";
     std::string error;
-    if (!obj->builder_->Feed(empty.c_str(), empty.size(), true, &error))
+    if (!obj->SetMode(MODE_SYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (!obj->CheckNotSuspended(&error))
       return Nan::ThrowError(error.c_str());
 
+    bool parsed;
+    if (!obj->ParseSync(empty.c_str(), empty.size(), true, false, 0, &parsed,
+        &error))
+      return;
+
+    if (!parsed)
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->native_)
+    {
+      info.GetReturnValue().Set(obj->AsyncResult());
+      return;
+    }
+
     StringList mapping_names(obj->builder_->mapping_names());
 
     Local<Object> result = Nan::New<Object>();
@@ -262,4 +424,692 @@ namespace nkit
     info.GetReturnValue().Set(result);
   }
 
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::FeedAsync)
+  {
+    Nan::HandleScope scope;
+
+    if (2 > info.Length() || !info[1]->IsFunction())
+      return Nan::ThrowError("Expected String or Buffer parameter"
+          " and callback function");
+
+    if (!node::Buffer::HasInstance(info[0]) && !info[0]->IsString())
+      return Nan::ThrowTypeError("Expected String or Buffer parameter");
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+
+    std::string error;
+    if (!obj->SetMode(MODE_ASYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->busy_ = true;
+    Nan::Callback * callback = new Nan::Callback(
+        Local<Function>::Cast(info[1]));
+    Nan::AsyncQueueWorker(new FeedAsyncWorker<Xml2VarBuilderWrapper>(
+        callback, obj, info.This(), info[0], false));
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::EndAsync)
+  {
+    Nan::HandleScope scope;
+
+    if (1 > info.Length() || !info[0]->IsFunction())
+      return Nan::ThrowError("Expected callback function");
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+
+    std::string error;
+    if (!obj->SetMode(MODE_ASYNC, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->busy_ = true;
+    Nan::Callback * callback = new Nan::Callback(
+        Local<Function>::Cast(info[0]));
+    Nan::AsyncQueueWorker(new FeedAsyncWorker<Xml2VarBuilderWrapper>(
+        callback, obj, info.This(), Nan::EmptyString(), true));
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::ParseParallelAsync)
+  {
+    Nan::HandleScope scope;
+
+    if (2 > info.Length() || !info[info.Length() - 1]->IsFunction())
+      return Nan::ThrowError("Expected String or Buffer parameter"
+          " and callback function");
+
+    if (!node::Buffer::HasInstance(info[0]) && !info[0]->IsString())
+      return Nan::ThrowTypeError("Expected String or Buffer parameter");
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+    if (obj->mode_ != MODE_NONE)
+      return Nan::ThrowError("parseParallelAsync() can't be used after"
+          " feed() or feedAsync(): call reset() first");
+
+    // more threads than CPUs don't speed up parsing, but default number
+    // is always allowed, so documents are split the same way everywhere
+    size_t max_threads = std::max(cpu_count(), DEFAULT_PARALLEL_THREADS);
+    size_t threads = DEFAULT_PARALLEL_THREADS;
+    if (info.Length() > 2)
+    {
+      if (!info[1]->IsObject())
+        return Nan::ThrowError("Options parameter must be Object");
+      Local<Value> value = Nan::Get(Local<Object>::Cast(info[1]),
+          Nan::New("threads").ToLocalChecked()).ToLocalChecked();
+      if (!value->IsUndefined())
+      {
+        if (!value->IsNumber() || !(value->NumberValue() >= 1.0))
+          return Nan::ThrowError("Option 'threads' must be positive number");
+        // too big number can't be converted to size_t
+        threads = static_cast<size_t>(std::min(value->NumberValue(),
+            static_cast<double>(max_threads)));
+      }
+    }
+
+    std::string record_name, error;
+    if (!obj->GetRecordName(&record_name, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->busy_ = true;
+    Nan::Callback * callback = new Nan::Callback(
+        Local<Function>::Cast(info[info.Length() - 1]));
+    Nan::AsyncQueueWorker(new ParallelParseWorker<Xml2VarBuilderWrapper>(
+        callback, obj, info.This(), info[0], record_name, threads));
+
+    info.GetReturnValue().Set(Nan::Undefined());
+  }
+
+  //----------------------------------------------------------------------------
+  // Records for parseParallelAsync() are children of root element, which
+  // are the first element of paths of all list mappings
+  bool Xml2VarBuilderWrapper::GetRecordName(std::string * record_name,
+      std::string * error) const
+  {
+    record_name->clear();
+    if (plan_->options().namespaces_)
+    {
+      // segments are split by prefixed names, but their prefixes are
+      // declared in root element
+      *error = "Parallel parsing doesn't support 'namespaces' option";
+      return false;
+    }
+
+    if (!plan_->options().limits_.empty())
+    {
+      // segments don't know how many items are found by other ones
+      *error = "Parallel parsing doesn't support 'limit' option";
+      return false;
+    }
+
+    DDICT_FOREACH(mapping, mappings_)
+    {
+      const Dynamic & spec = mapping->second;
+      static const size_t PATH_POS = 0;
+      if (!spec.IsList() || spec.empty() || !spec[PATH_POS].IsString())
+      {
+        *error = "Parallel parsing supports list mappings only, but mapping '"
+            + mapping->first + "' is not a list";
+        return false;
+      }
+
+      const std::string & path = spec[PATH_POS].GetConstString();
+      size_t begin = path.find_first_not_of('/');
+      size_t end = path.find('/', begin);
+      std::string name = begin == std::string::npos || begin > 1 ? "" :
+          path.substr(begin, end == std::string::npos ? end : end - begin);
+      if (name.empty() || name == "*" || name[0] == '@'
+          || (!record_name->empty() && name != *record_name))
+      {
+        *error = "Parallel parsing requires list mappings of records,"
+            " which are children of root element with the same name";
+        return false;
+      }
+      *record_name = name;
+    }
+
+    if (record_name->empty())
+    {
+      *error = "Parallel parsing requires at least one list mapping";
+      return false;
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  Local<Value> Xml2VarBuilderWrapper::ParallelResult(const Dynamic & result)
+  {
+    Nan::EscapableHandleScope scope;
+
+    if (!columnar_)
+      return scope.Escape(dynamic_to_v8var(result, plan_->options().int64_));
+
+    Local<Object> columnar_result = Nan::New<Object>();
+    DDICT_FOREACH(mapping, result)
+    {
+      Columns columns;
+      DLIST_FOREACH(item, mapping->second)
+        columns.Append(*item);
+      columnar_result->Set(Nan::New(mapping->first).ToLocalChecked(),
+          columns.ToV8(true));
+    }
+
+    return scope.Escape(columnar_result);
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::SetMode(Mode mode, std::string * error)
+  {
+    if (busy_)
+    {
+      *error = "Builder is busy with asynchronous operation";
+      return false;
+    }
+
+    if (mode_ == MODE_NONE)
+    {
+      if (mode == MODE_ASYNC && !async_builder_
+          && !CreateNativeBuilder(error))
+        return false;
+      if (mode == MODE_SYNC && !native_ && !builder_
+          && !CreateV8Builder(error))
+        return false;
+      mode_ = mode;
+    }
+    else if (mode_ != mode)
+    {
+      *error = "Can't mix synchronous and asynchronous methods"
+          " on one builder";
+      return false;
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::CreateV8Builder(std::string * error)
+  {
+    builder_ = StructXml2VarBuilder<V8VarBuilder>::Create(plan_);
+
+    ItemCallbacks::const_iterator it = item_callbacks_.begin(),
+        end = item_callbacks_.end();
+    for (; it != end; ++it)
+    {
+      if (!builder_->SetItemListener(it->first,
+          static_cast<ItemListener<V8VarBuilder> *>(this), error))
+        return false;
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::CreateNativeBuilder(std::string * error)
+  {
+    async_builder_ = AsyncBuilder::Create(plan_);
+
+    ItemCallbacks::const_iterator it = item_callbacks_.begin(),
+        end = item_callbacks_.end();
+    for (; it != end; ++it)
+    {
+      if (!async_builder_->SetItemListener(it->first,
+          static_cast<ItemListener<DynamicBuilder> *>(this), error))
+        return false;
+    }
+
+    // every list mapping passes its items to columns or to native lists
+    StringList mapping_names(async_builder_->mapping_names());
+    StringList::const_iterator mapping_name = mapping_names.begin(),
+        names_end = mapping_names.end();
+    for (; mapping_name != names_end; ++mapping_name)
+    {
+      std::string not_list_error;
+      if (!async_builder_->SetItemListener(*mapping_name,
+          static_cast<ItemListener<DynamicBuilder> *>(this),
+          &not_list_error))
+        continue;
+      if (columnar_)
+        columns_[*mapping_name] = Columns::Ptr(new Columns);
+      else
+        native_lists_[*mapping_name] = Dynamic::List();
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  Local<Value> Xml2VarBuilderWrapper::NativeResult(
+      const std::string & mapping_name, bool release)
+  {
+    Nan::EscapableHandleScope scope;
+
+    ColumnsMap::const_iterator columns = columns_.find(mapping_name);
+    if (columns != columns_.end()
+        && item_callbacks_.find(mapping_name) == item_callbacks_.end())
+      return scope.Escape(columns->second->ToV8(release));
+
+    bool int64 = plan_->options().int64_;
+    NativeLists::iterator list = native_lists_.find(mapping_name);
+    if (list == native_lists_.end()
+        || item_callbacks_.find(mapping_name) != item_callbacks_.end())
+      return scope.Escape(dynamic_to_v8var(async_builder_->var(mapping_name),
+          int64));
+
+    // converted items are released, next call appends new ones only
+    Local<Object> native_result = Nan::New(native_result_);
+    Local<String> name = Nan::New(mapping_name).ToLocalChecked();
+    Local<Value> value = Nan::Get(native_result, name).ToLocalChecked();
+    Local<Array> items;
+    uint32_t length = 0;
+    if (value->IsArray())
+    {
+      items = Local<Array>::Cast(value);
+      length = items->Length();
+    }
+    else
+    {
+      items = Nan::New<Array>(static_cast<int>(list->second.size()));
+      Nan::Set(native_result, name, items);
+    }
+    DLIST_FOREACH(item, list->second)
+      Nan::Set(items, length++, dynamic_to_v8var(*item, int64));
+    list->second = Dynamic::List();
+    return scope.Escape(items);
+  }
+
+  //----------------------------------------------------------------------------
+  Local<Value> Xml2VarBuilderWrapper::AsyncResult()
+  {
+    Nan::EscapableHandleScope scope;
+
+    StringList mapping_names(async_builder_->mapping_names());
+
+    Local<Object> result = Nan::New<Object>();
+    StringList::const_iterator mapping_name = mapping_names.begin(),
+        end = mapping_names.end();
+    for (; mapping_name != end; ++mapping_name)
+    {
+      Local<Value> item = NativeResult(*mapping_name, true);
+      result->Set(Nan::New(*mapping_name).ToLocalChecked(), item);
+    }
+
+    return scope.Escape(result);
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::SetItemCallback)
+  {
+    Nan::HandleScope scope;
+
+    if (2 > info.Length() || !info[0]->IsString() || !info[1]->IsFunction())
+      return Nan::ThrowError("Expected mapping name and callback function");
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    String::Utf8Value utf8_value(info[0]);
+    std::string mapping_name(*utf8_value, utf8_value.length());
+
+    std::string error;
+    if (!obj->plan_->CheckListMapping(mapping_name, &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->builder_ && !obj->builder_->SetItemListener(mapping_name,
+        static_cast<ItemListener<V8VarBuilder> *>(obj), &error))
+      return Nan::ThrowError(error.c_str());
+
+    if (obj->async_builder_ && !obj->async_builder_->SetItemListener(
+        mapping_name, static_cast<ItemListener<DynamicBuilder> *>(obj),
+        &error))
+      return Nan::ThrowError(error.c_str());
+
+    Nan::Callback *& callback = obj->item_callbacks_[mapping_name];
+    delete callback;
+    callback = new Nan::Callback(Local<Function>::Cast(info[1]));
+
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::Reset)
+  {
+    Nan::HandleScope scope;
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    // parser and targets are reused
+    if (obj->builder_)
+    {
+      obj->builder_->Restart();
+      obj->builder_->Clear();
+    }
+    if (obj->async_builder_)
+    {
+      obj->async_builder_->Restart();
+      obj->async_builder_->Clear();
+    }
+    obj->mode_ = MODE_NONE;
+    obj->paused_ = false;
+    obj->pending_names_.clear();
+    obj->pending_items_.Reset(Nan::New<Array>());
+    obj->async_items_.clear();
+    ColumnsMap::iterator columns = obj->columns_.begin(),
+        columns_end = obj->columns_.end();
+    for (; columns != columns_end; ++columns)
+      columns->second->Clear();
+    NativeLists::iterator list = obj->native_lists_.begin(),
+        lists_end = obj->native_lists_.end();
+    for (; list != lists_end; ++list)
+      list->second = Dynamic::List();
+    obj->native_result_.Reset(Nan::New<Object>());
+
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::Pause)
+  {
+    Nan::HandleScope scope;
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+    obj->paused_ = true;
+    info.GetReturnValue().Set(info.This());
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::Resume)
+  {
+    Nan::HandleScope scope;
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    if (obj->busy_)
+      return Nan::ThrowError("Builder is busy with asynchronous operation");
+
+    std::string error;
+    uint64_t deadline;
+    if (!get_deadline(info[0], &deadline, &error))
+      return Nan::ThrowError(error.c_str());
+
+    obj->paused_ = false;
+    if (obj->suspended() || obj->queued())
+    {
+      bool parsed;
+      if (!obj->ParseSync(NULL, 0, false, true, deadline, &parsed, &error))
+        return;
+      if (!parsed)
+        return Nan::ThrowError(error.c_str());
+    }
+
+    info.GetReturnValue().Set(Nan::New(obj->finished()));
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::IsSuspended)
+  {
+    Nan::HandleScope scope;
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    info.GetReturnValue().Set(Nan::New(obj->suspended()));
+  }
+
+  //----------------------------------------------------------------------------
+  NAN_METHOD(Xml2VarBuilderWrapper::IsPaused)
+  {
+    Nan::HandleScope scope;
+
+    Xml2VarBuilderWrapper* obj = ObjectWrap::Unwrap<Xml2VarBuilderWrapper>(
+        info.This());
+    info.GetReturnValue().Set(Nan::New(obj->paused_));
+  }
+
+  //----------------------------------------------------------------------------
+  // Parses chunk in the main thread (or continues parsing of suspended
+  // chunk if 'resume' is true) and passes items to callbacks. Parser is
+  // suspended as soon as "high_water_mark" items are queued, so items are
+  // passed to callbacks by portions.
+  // Parsing of chunk is continued after each portion, unless pause() has
+  // been called from callback (then the rest of items stays in queues
+  // until resume(); end() ignores pause()) or 'deadline' is
+  // reached: parser is suspended every ELEMENTS_PER_TIME_CHECK elements
+  // to check time.
+  // Items, left in queues by exception in callback, are passed first
+  // (chunk is parsed even if callback throws again).
+  // Returns false if callback has thrown exception.
+  bool Xml2VarBuilderWrapper::ParseSync(const char * data, size_t length,
+      bool last, bool resume, uint64_t deadline, bool * parsed,
+      std::string * error)
+  {
+    *parsed = true;
+    bool emitted = EmitItems(false, !last);
+    if (resume && (paused_ || !suspended()))
+      return emitted;
+
+    size_t suspend_interval = deadline ? ELEMENTS_PER_TIME_CHECK : 0;
+    if (native_)
+      async_builder_->SetSuspendInterval(suspend_interval);
+    else
+      builder_->SetSuspendInterval(suspend_interval);
+
+    if (resume)
+      *parsed = ResumeParser(error);
+    else if (native_)
+      *parsed = async_builder_->Feed(data, length, last, error);
+    else
+      *parsed = builder_->Feed(data, length, last, error);
+    if (!emitted)
+      return false;
+
+    while (true)
+    {
+      if (!EmitItems(false, !last))
+        return false;
+      if (!*parsed || !suspended())
+        return true;
+      if (!last && (paused_ || (deadline && uv_hrtime() >= deadline)))
+        return true;
+      *parsed = ResumeParser(error);
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::CheckNotSuspended(std::string * error) const
+  {
+    if (paused_)
+      *error = "Builder is paused: call resume() first";
+    else if (suspended())
+      *error = "Chunk is not parsed completely: call resume() first";
+    else
+      return true;
+    return false;
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::ResumeParser(std::string * error)
+  {
+    if (native_)
+      return async_builder_->Resume(error);
+    return builder_->Resume(error);
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::suspended() const
+  {
+    if (native_ || mode_ == MODE_ASYNC)
+      return async_builder_->suspended();
+    return builder_ && builder_->suspended();
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::queued() const
+  {
+    return !pending_names_.empty() || !async_items_.empty();
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::finished() const
+  {
+    if (native_ || mode_ == MODE_ASYNC)
+      return async_builder_->finished();
+    return builder_ && builder_->finished();
+  }
+
+  //----------------------------------------------------------------------------
+  Xml2VarBuilderWrapper::~Xml2VarBuilderWrapper()
+  {
+    ItemCallbacks::iterator it = item_callbacks_.begin(),
+        end = item_callbacks_.end();
+    for (; it != end; ++it)
+      delete it->second;
+    pending_items_.Reset();
+    native_result_.Reset();
+  }
+
+  //----------------------------------------------------------------------------
+  void Xml2VarBuilderWrapper::OnItem(const std::string & target_name,
+      const V8VarBuilder::type & item)
+  {
+    Nan::HandleScope scope;
+    Local<Array> items = Nan::New(pending_items_);
+    Nan::Set(items, static_cast<uint32_t>(pending_names_.size()),
+        Nan::New(item));
+    pending_names_.push_back(target_name);
+    // pause() stops parsing right after current item
+    if (paused_ || pending_names_.size() >= max_pending_items_)
+      builder_->Suspend();
+  }
+
+  //----------------------------------------------------------------------------
+  void Xml2VarBuilderWrapper::OnItem(const std::string & target_name,
+      const Dynamic & item)
+  {
+    // called from libuv thread pool: no V8 here
+    if (item_callbacks_.find(target_name) == item_callbacks_.end())
+    {
+      if (columnar_)
+        columns_[target_name]->Append(item);
+      else
+        native_lists_[target_name].PushBack(item);
+    }
+    else
+    {
+      async_items_.push_back(std::make_pair(target_name, item));
+      // only main thread parsing can be suspended
+      if (mode_ == MODE_SYNC && (paused_
+          || async_items_.size() >= max_pending_items_))
+        async_builder_->Suspend();
+    }
+  }
+
+  //----------------------------------------------------------------------------
+  bool Xml2VarBuilderWrapper::EmitItems(bool is_async, bool pausable)
+  {
+    Nan::HandleScope scope;
+
+    // callbacks may call methods of this builder, so queues are detached
+    // before calling
+    StringVector names;
+    names.swap(pending_names_);
+    Local<Array> items = Nan::New(pending_items_);
+    if (!names.empty())
+      pending_items_.Reset(Nan::New<Array>());
+    AsyncItems async_items;
+    async_items.swap(async_items_);
+
+    size_t count = names.size() + async_items.size();
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (pausable && paused_)
+      {
+        // pause() from callback: the rest of items is passed by resume()
+        RequeueItems(names, items, &async_items, i);
+        return true;
+      }
+
+      Local<Value> argv[1];
+      const std::string * name;
+      if (i < names.size())
+      {
+        name = &names[i];
+        argv[0] = Nan::Get(items, static_cast<uint32_t>(i)).ToLocalChecked();
+      }
+      else
+      {
+        const AsyncItems::value_type & async_item =
+            async_items[i - names.size()];
+        name = &async_item.first;
+        argv[0] = dynamic_to_v8var(async_item.second,
+            plan_->options().int64_);
+      }
+
+      ItemCallbacks::const_iterator callback = item_callbacks_.find(*name);
+      if (callback == item_callbacks_.end())
+        continue;
+
+      if (is_async)
+        callback->second->Call(1, argv);
+      else if (callback->second->GetFunction()->Call(
+          Nan::GetCurrentContext()->Global(), 1, argv).IsEmpty())
+      {
+        // exception in callback: the rest of items is passed by the next
+        // feed(), end() or resume()
+        RequeueItems(names, items, &async_items, i + 1);
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //----------------------------------------------------------------------------
+  // Puts detached items, starting from 'from', back to queues before items,
+  // which have been queued by callbacks themselves
+  void Xml2VarBuilderWrapper::RequeueItems(const StringVector & names,
+      Local<Array> items, AsyncItems * async_items, size_t from)
+  {
+    StringVector rest_names;
+    Local<Array> rest_items = Nan::New<Array>();
+    for (size_t i = from; i < names.size(); ++i)
+    {
+      Nan::Set(rest_items, static_cast<uint32_t>(rest_names.size()),
+          Nan::Get(items, static_cast<uint32_t>(i)).ToLocalChecked());
+      rest_names.push_back(names[i]);
+    }
+    Local<Array> queued_items = Nan::New(pending_items_);
+    for (size_t i = 0; i < pending_names_.size(); ++i)
+    {
+      Nan::Set(rest_items, static_cast<uint32_t>(rest_names.size()),
+          Nan::Get(queued_items, static_cast<uint32_t>(i)).ToLocalChecked());
+      rest_names.push_back(pending_names_[i]);
+    }
+    pending_names_.swap(rest_names);
+    pending_items_.Reset(rest_items);
+
+    size_t async_from = from > names.size() ? from - names.size() : 0;
+    async_items->erase(async_items->begin(),
+        async_items->begin() + std::min(async_from, async_items->size()));
+    async_items->insert(async_items->end(), async_items_.begin(),
+        async_items_.end());
+    async_items_.swap(*async_items);
+  }
+
 }  // namespace nkit
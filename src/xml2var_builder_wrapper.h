@@ -20,32 +20,169 @@
 #include <node_object_wrap.h>
 #include <nan.h>
 #include "v8_var_policy.h"
+#include "feed_async_worker.h"
+#include "parallel_parse_worker.h"
+#include "columns.h"
+
+#include "nkit/dynamic/dynamic_builder.h"
 
 namespace nkit
 {
   typedef VarBuilder<V8BuilderPolicy> V8VarBuilder;
 
-  class Xml2VarBuilderWrapper: public Nan::ObjectWrap
+  //----------------------------------------------------------------------------
+  // Result of nkit.compileMapping(): options and mappings, parsed and
+  // compiled to plan once, for creating any number of Xml2VarBuilder objects
+  class CompiledMappingWrapper: public Nan::ObjectWrap
   {
+    friend class Xml2VarBuilderWrapper;
+
   public:
     static void Init(v8::Handle<v8::Object> exports);
 
   private:
-    explicit Xml2VarBuilderWrapper(StructXml2VarBuilder<V8VarBuilder>::Ptr builder)
-      : builder_(builder)
+    CompiledMappingWrapper(const Xml2VarPlan::Ptr & plan,
+        const Dynamic & options, const Dynamic & mappings)
+      : plan_(plan)
+      , options_(options)
+      , mappings_(mappings)
     {}
 
-    ~Xml2VarBuilderWrapper()
+    ~CompiledMappingWrapper()
     {}
 
+    static NAN_METHOD(New);
+    static NAN_METHOD(Compile);
+
+    static Nan::Persistent<v8::FunctionTemplate> constructor_template;
+    static Nan::Persistent<v8::Function> constructor;
+
+    const Xml2VarPlan::Ptr plan_;
+    const Dynamic options_;
+    const Dynamic mappings_;
+  };
+
+  //----------------------------------------------------------------------------
+  class Xml2VarBuilderWrapper: public Nan::ObjectWrap
+    , private ItemListener<V8VarBuilder>
+    , private ItemListener<DynamicBuilder>
+  {
+    friend class FeedAsyncWorker<Xml2VarBuilderWrapper>;
+    friend class ParallelParseWorker<Xml2VarBuilderWrapper>;
+    typedef StructXml2VarBuilder<DynamicBuilder> AsyncBuilder;
+    typedef std::map<std::string, Nan::Callback *> ItemCallbacks;
+    typedef std::vector<std::pair<std::string, Dynamic> > AsyncItems;
+    typedef std::map<std::string, Columns::Ptr> ColumnsMap;
+    typedef std::map<std::string, Dynamic> NativeLists;
+
+    enum Mode
+    {
+      MODE_NONE,
+      MODE_SYNC,
+      MODE_ASYNC
+    };
+
+  public:
+    static void Init(v8::Handle<v8::Object> exports);
+
+  private:
+    Xml2VarBuilderWrapper(const Xml2VarPlan::Ptr & plan,
+        const Dynamic & mappings, bool native, bool columnar,
+        size_t max_pending_items)
+      : plan_(plan)
+      , builder_()
+      , async_builder_()
+      , mappings_(mappings)
+      , mode_(MODE_NONE)
+      , busy_(false)
+      , paused_(false)
+      , max_pending_items_(max_pending_items)
+      , native_(native)
+      , columnar_(columnar)
+    {
+      pending_items_.Reset(Nan::New<v8::Array>());
+      native_result_.Reset(Nan::New<v8::Object>());
+    }
+
+    ~Xml2VarBuilderWrapper();
+
     static NAN_METHOD(New);
     static NAN_METHOD(Feed);
     static NAN_METHOD(Get);
     static NAN_METHOD(End);
+    static NAN_METHOD(FeedAsync);
+    static NAN_METHOD(EndAsync);
+    static NAN_METHOD(SetItemCallback);
+    static NAN_METHOD(Reset);
+    static NAN_METHOD(Pause);
+    static NAN_METHOD(Resume);
+    static NAN_METHOD(IsPaused);
+    static NAN_METHOD(IsSuspended);
+    static NAN_METHOD(ParseParallelAsync);
+
+    bool SetMode(Mode mode, std::string * error);
+    bool CreateV8Builder(std::string * error);
+    bool CreateNativeBuilder(std::string * error);
+    v8::Local<v8::Value> NativeResult(const std::string & mapping_name,
+        bool release);
+    v8::Local<v8::Value> AsyncResult();
+    v8::Local<v8::Value> ParallelResult(const Dynamic & result);
+    bool GetRecordName(std::string * record_name, std::string * error) const;
+    bool ParseSync(const char * data, size_t length, bool last, bool resume,
+        uint64_t deadline, bool * parsed, std::string * error);
+    bool CheckNotSuspended(std::string * error) const;
+    bool ResumeParser(std::string * error);
+    bool suspended() const;
+    // some items are left in queues for callbacks
+    bool queued() const;
+    bool finished() const;
+
+    // ItemListener interfaces: items are queued during parsing and are passed
+    // to JavaScript callbacks by EmitItems() after parsing of chunk
+    void OnItem(const std::string & target_name,
+        const V8VarBuilder::type & item);
+    void OnItem(const std::string & target_name, const Dynamic & item);
+    // If 'pausable', pause() from callback stops passing of items
+    bool EmitItems(bool is_async, bool pausable = false);
+    void RequeueItems(const StringVector & names, v8::Local<v8::Array> items,
+        AsyncItems * async_items, size_t from);
 
     static Nan::Persistent<v8::Function> constructor;
 
+    Xml2VarPlan::Ptr plan_;
+    // Builder of V8 values for feed() and end(): is created by the first
+    // of them (or by get()), unless "native" option is set
     StructXml2VarBuilder<V8VarBuilder>::Ptr builder_;
+    // Native builder for feedAsync()/endAsync() and for "native" and
+    // "columnar" modes: is used from libuv thread pool, so it must not
+    // contain any V8 values
+    AsyncBuilder::Ptr async_builder_;
+    Dynamic mappings_;
+    Mode mode_;
+    bool busy_;
+    // pause() has been called: parsing of suspended chunk is continued
+    // by resume()
+    bool paused_;
+    // "high_water_mark" option: parser is suspended when this number
+    // of items is queued for callbacks
+    size_t max_pending_items_;
+    ItemCallbacks item_callbacks_;
+    StringVector pending_names_;
+    Nan::Persistent<v8::Array> pending_items_;
+    AsyncItems async_items_;
+    // "native" option: feed() and end() build data in native builder too,
+    // it is converted to V8 values by get() and end() at once
+    bool native_;
+    // "columnar" option (implies "native"): items of list mappings are split
+    // to columns
+    bool columnar_;
+    ColumnsMap columns_;
+    // Native builder passes items of list mappings to native_lists_,
+    // get() and end() move them to arrays of native_result_, so get()
+    // returns the same arrays as without "native" option, and converts only
+    // new items
+    NativeLists native_lists_;
+    Nan::Persistent<v8::Object> native_result_;
   };
 
 }  // namespace nkit
@@ -67,6 +67,33 @@ function(callback) {
 	callback(null);
 },
 
+function(callback) {
+	console.log("Streaming with Xml2VarBuilder.onItem()");
+	var mapping = [ "/offer", {
+		"/id" : "string",
+		"/price" : "number",
+		"/note" : "string"
+	} ];
+	var builder = new nkit.Xml2VarBuilder({
+		"main" : mapping
+	});
+	var count = 0;
+	// items are not accumulated in builder, so memory usage depends on
+	// size of one item, not on size of whole file
+	builder.onItem("main", function(item) {
+		count++;
+	});
+	var rstream = fs.createReadStream(xmlFile);
+	rstream.on('data', function(chunk) {
+		builder.feed(chunk);
+	}).on('end', function() {
+		builder.end();
+		console.log("Xml2VarBuilder.onItem() streaming. Items count = %d", count);
+	});
+	console.info("")
+	callback(null);
+},
+
 function(callback) {
 	console.log("Streaming with AnyXml2VarBuilder");
 	var options = {
@@ -90,4 +117,27 @@ function(callback) {
 	callback(null);
 },
 
+function(callback) {
+	console.log("Streaming with AnyXml2VarBuilder.onItem()");
+	var options = {
+		trim : true,
+		explicit_array : false
+	}
+	var builder = new nkit.AnyXml2VarBuilder(options);
+	var count = 0;
+	// <offer> elements are not accumulated in builder
+	builder.onItem("offer", function(item, name) {
+		count++;
+	});
+	var rstream = fs.createReadStream(xmlFile);
+	rstream.on('data', function(chunk) {
+		builder.feed(chunk);
+	}).on('end', function() {
+		builder.end();
+		console.log("AnyXml2VarBuilder.onItem() streaming. Items count = %d", count);
+	});
+	console.info("")
+	callback(null);
+},
+
 ]);
@@ -218,6 +218,55 @@ if (!deep_equal.deepEquals(res, builder.get("map_name"))) {
     process.exit(1);
 }
 
+// mappings object: undefined values and functions are skipped as
+// in JSON.stringify()
+mappings = {"map_name": ["/person/phone", "string"],
+            "skipped": undefined,
+            "skipped_too": function() {}};
+
+builder = new nkit.Xml2VarBuilder({"trim": true, "unused": [1, 2.5, null]},
+    mappings);
+builder.feed(xmlString);
+res = builder.end();
+
+if (!deep_equal.deepEquals(res, {"map_name": etalon})) {
+    console.error(JSON.stringify(res, null, 2));
+    console.error("Error #3.3");
+    process.exit(1);
+}
+
+// circular options
+var options = {"trim": true};
+options["self"] = options;
+try {
+    new nkit.Xml2VarBuilder(options, mappings);
+    console.error("Error #3.4");
+    process.exit(1);
+} catch (e) {}
+
+// exceptions of getters are reported as errors
+var options = {"trim": true};
+Object.defineProperty(options, "attrkey", {enumerable: true,
+    get: function () { throw new Error("bad getter"); }});
+try {
+    new nkit.Xml2VarBuilder(options, mappings);
+    console.error("Error #3.5");
+    process.exit(1);
+} catch (e) {
+    if (e.message.indexOf("bad getter") === -1) {
+        console.error("Error #3.6");
+        process.exit(1);
+    }
+}
+
+// numbers out of int64 range
+[1e300, -Infinity, NaN].forEach(function (limit) {
+    try {
+        new nkit.Xml2VarBuilder({"limit": {"map_name": limit},
+            "unused": limit}, mappings);
+    } catch (e) {}
+});
+
 // -----------------------------------------------------------------------------
 // collecting attributes
 options = {"attrkey": "$"};
@@ -400,6 +449,26 @@ if (result["status"][0] != "1" || result["status"][1] != "2") {
     process.exit(1);
 }
 
+// more distinct keys than key cache can hold
+xml = ["<root>"];
+for (var i = 0; i < 3000; i++) {
+    xml.push("<e" + i + ">" + i + "</e" + i + "><e" + (i % 7) + ">x</e"
+        + (i % 7) + ">");
+}
+xml.push("</root>");
+var builder = new nkit.AnyXml2VarBuilder(options)
+builder.feed(xml.join(""))
+var result = builder.end()
+for (var i = 0; i < 3000; i++) {
+    var expected = i < 7 ? 1 + Math.ceil((3000 - i) / 7) : 1;
+    var value = result["e" + i];
+    var length = Array.isArray(value) ? value.length : 1;
+    if (length != expected || (Array.isArray(value) ? value[0] : value) != String(i)) {
+        console.error("Error #7.5: e" + i);
+        process.exit(1);
+    }
+}
+
 // -----------------------------------------------------------------------------
 // true_variants & false_variants
 // -----------------------------------------------------------------------------
@@ -463,7 +532,163 @@ if (   result[0]["boolean"] != true
     console.error("Error #8.2");
     process.exit(1);
 }
-    
+
+// -----------------------------------------------------------------------------
+// objects of list get keys in the same order regardless of element order
+// and default values
+// -----------------------------------------------------------------------------
+xml = "<root><item><b>1</b><a>2</a><c>3</c></item>"
+    + "<item><c>4</c><a>5</a></item><item><a>6</a><b>7</b></item></root>";
+mappings = {"main": ["/item", {"/a": "string", "/b": "string|-",
+                               "/c": "integer|0", "/c -> c2": "string"}]};
+var builder = new nkit.Xml2VarBuilder(mappings)
+builder.feed(xml)
+var result = builder.end()["main"]
+if (!deep_equal.deepEquals(result, [{"a": "2", "b": "1", "c": 3, "c2": "3"},
+                                    {"a": "5", "b": "-", "c": 4, "c2": "4"},
+                                    {"a": "6", "b": "7", "c": 0}])
+    || Object.keys(result[0]).join() != Object.keys(result[1]).join()
+    || Object.keys(result[0]).join().indexOf(Object.keys(result[2]).join())
+        != 0) {
+    console.error(JSON.stringify(result, null, 2));
+    console.error("Error #8.3");
+    process.exit(1);
+}
+
+// -----------------------------------------------------------------------------
+// numbers; "int64" option: integers out of int32 range are returned as Number
+// -----------------------------------------------------------------------------
+xml = "<root><item><i>3000000000</i><f> -1.25e2</f></item>"
+    + "<item><i>-7</i><f>0.1</f></item></root>";
+mappings = {"main": ["/item", {"/i": "integer", "/f": "number"}]};
+var builder = new nkit.Xml2VarBuilder({"int64": true}, mappings)
+builder.feed(xml)
+var result = builder.end()["main"]
+check_result(result, [{"i": 3000000000, "f": -125}, {"i": -7, "f": 0.1}],
+    "8.4")
+
+// -----------------------------------------------------------------------------
+// "columnar" option: items of list mappings are split to columns
+// -----------------------------------------------------------------------------
+function column_to_array(column, error_number) {
+    if (!(column instanceof Float64Array)) {
+        console.error("Error #" + error_number + ": Float64Array expected");
+        process.exit(1);
+    }
+    return Array.prototype.slice.call(column).map(function (v) {
+        return isNaN(v) ? "NaN" : v;
+    });
+}
+
+var columnar_xml = ["<root>",
+    "<offer id='a'><price>1.5</price><rooms>2</rooms></offer>",
+    "<offer id='b'><price>2</price></offer>",
+    "<offer id='c'><price>3.25</price><rooms>3</rooms></offer>",
+    "</root>"];
+var columnar_mappings = {
+    "offers": ["/offer", {"/@id -> id": "string", "/price": "number",
+                          "/rooms": "integer"}],
+    "prices": ["/offer/price", "number"],
+    "last": {"/offer/@id -> id": "string"}
+};
+var columnar_etalon = {
+    "id": ["a", "b", "c"],
+    "price": [1.5, 2, 3.25],
+    "rooms": [2, "NaN", 3],
+    "prices": [1.5, 2, 3.25],
+    "last": {"id": "c"}
+};
+
+function check_columnar_result(result, error_number) {
+    check_result({
+        "id": result["offers"]["id"],
+        "price": column_to_array(result["offers"]["price"], error_number),
+        "rooms": column_to_array(result["offers"]["rooms"], error_number),
+        "prices": column_to_array(result["prices"], error_number),
+        "last": result["last"]
+    }, columnar_etalon, error_number);
+}
+
+var builder = new nkit.Xml2VarBuilder({"columnar": true}, columnar_mappings)
+builder.feed(columnar_xml.slice(0, 3).join(""))
+check_result(column_to_array(builder.get("prices"), "8.5"), [1.5, 2], "8.5")
+builder.feed(columnar_xml.slice(3).join(""))
+check_columnar_result(builder.end(), "8.6")
+
+// -----------------------------------------------------------------------------
+// datetime values: ISO-8601 and other formats; the same timezone offset
+// is applied to all of them
+// -----------------------------------------------------------------------------
+xml = "<root><item><d>2014-08-22</d><t>2014-08-22T13:59:06</t>"
+    + "<s>1979-02-28 12:13:14</s><o>22.08.1900</o></item>"
+    + "<item><d>2014-8-1</d><t>2014-13-22T13:59:06</t>"
+    + "<s>1979-02-28 12:13:14 </s><o>01.01.2100</o></item></root>";
+mappings = {"main": ["/item", {
+    "/d": "datetime|2000-01-01|%Y-%m-%d",
+    "/t": "datetime|2000-01-01T00:00:00|%Y-%m-%dT%H:%M:%S",
+    "/s": "datetime|2000-01-01 00:00:00|%Y-%m-%d %H:%M:%S",
+    "/o": "datetime|01.01.2000|%d.%m.%Y"}]};
+var builder = new nkit.Xml2VarBuilder(mappings)
+builder.feed(xml)
+var result = builder.end()["main"];
+var tz_offset = result[0]["d"].getTime() - Date.UTC(2014, 7, 22);
+function local_time(year, month, day, hours, minutes, seconds) {
+    return Date.UTC(year, month, day, hours || 0, minutes || 0, seconds || 0)
+        + tz_offset;
+}
+result = result.map(function (item) {
+    var times = {};
+    for (var key in item)
+        times[key] = item[key] instanceof Date ? item[key].getTime() : "-";
+    return times;
+});
+check_result(result, [
+    {"d": local_time(2014, 7, 22),
+     "t": local_time(2014, 7, 22, 13, 59, 6),
+     "s": local_time(1979, 1, 28, 12, 13, 14),
+     "o": local_time(1900, 7, 22)},
+    {"d": local_time(2014, 7, 1),
+     "t": "-",
+     "s": local_time(1979, 1, 28, 12, 13, 14),
+     "o": local_time(2100, 0, 1)}], "8.7")
+
+// -----------------------------------------------------------------------------
+// "limit" option: parsing stops as soon as all mappings are completed
+// -----------------------------------------------------------------------------
+xml = "<root><header><title>T</title><date>D</date></header>"
+    + "<item>1</item><item>2</item><item>3</item>";
+mappings = {"header": {"/header/title": "string", "/header/date": "string"},
+            "main": ["/item", "string"]};
+var builder = new nkit.Xml2VarBuilder({"limit": {"main": 2}}, mappings)
+if (builder.feed(xml) !== true || builder.feed("<wrong>xml</right>") !== true) {
+    console.error("Error #8.8");
+    process.exit(1);
+}
+check_result(builder.end(), {"header": {"title": "T", "date": "D"},
+                             "main": ["1", "2"]}, "8.9")
+if (builder.feed("<root><item>1</item>") !== false) {
+    console.error("Error #8.10");
+    process.exit(1);
+}
+
+try {
+    new nkit.Xml2VarBuilder({"limit": {"header": 1}}, mappings);
+    console.error("Error #8.11");
+    process.exit(1);
+} catch (e) {
+}
+
+try {
+    new nkit.Xml2VarBuilder({"limit": {"mian": 1}}, mappings);
+    console.error("Error #8.12");
+    process.exit(1);
+} catch (e) {
+    if (e.message.indexOf("Unknown mapping name") === -1) {
+        console.error("Error #8.13");
+        process.exit(1);
+    }
+}
+
 // -----------------------------------------------------------------------------
 // -----------------------------------------------------------------------------
 data = [{
@@ -525,8 +750,545 @@ console.log(nkit.var2xml(data, options));
 
 console.log(nkit.var2xml([], options));
 
-console.log("ok");
-process.exit(0);
+// -----------------------------------------------------------------------------
+// onItem(): list items are passed to callback instead of accumulating them
+// -----------------------------------------------------------------------------
+var xmlString = fs.readFileSync(__dirname + "/data/sample.xml");
+
+var mappings = {
+    "main": ["/person", {
+        "/name": "string",
+        "/age": "integer",
+        "/birthday": "datetime|Fri, 22 Aug 2014 13:59:06 +0000|%a, %d %b %Y %H:%M:%S %z",
+        "/phone -> phones": ["/", "string"],
+        "/address -> cities": ["/city", "string"],
+        "/married/@firstTime -> isMerriedFirstTime": "boolean"
+    }],
+    "phones": ["/person/phone", "string"]
+};
+
+var builder = new nkit.Xml2VarBuilder(mappings);
+builder.feed(xmlString);
+var sync_result = builder.end();
+
+function check_result(result, etalon, error_number) {
+    if (!deep_equal.deepEquals(result, etalon)) {
+        console.error(JSON.stringify(etalon, null, 2));
+        console.error(JSON.stringify(result, null, 2));
+        console.error("Error #" + error_number);
+        process.exit(1);
+    }
+}
+
+var items = [];
+var builder = new nkit.Xml2VarBuilder(mappings);
+builder.onItem("main", function (item) {
+    items.push(item);
+});
+builder.feed(xmlString.slice(0, 800));
+builder.feed(xmlString.slice(800));
+var result = builder.end();
+if (!deep_equal.deepEquals(items, sync_result["main"])
+    || result["main"].length !== 0
+    || !deep_equal.deepEquals(result["phones"], sync_result["phones"])) {
+    console.error(JSON.stringify(items, null, 2));
+    console.error("Error #9.1");
+    process.exit(1);
+}
+
+try {
+    builder.onItem("unknown", function () {});
+    console.error("Error #9.2");
+    process.exit(1);
+} catch (e) {}
+
+// exception in callback stops feed()
+var builder = new nkit.Xml2VarBuilder(mappings);
+builder.onItem("main", function (item) {
+    throw new Error("stop");
+});
+try {
+    builder.feed(xmlString);
+    console.error("Error #9.3");
+    process.exit(1);
+} catch (e) {
+    if (e.message !== "stop") {
+        console.error("Error #9.4");
+        process.exit(1);
+    }
+}
+
+// items after the one, whose callback has thrown exception, are not lost:
+// they are passed by the next feed() or end()
+var thrown_xml = "<root>";
+for (var i = 0; i < 10; i++)
+    thrown_xml += "<item>" + i + "</item>";
+thrown_xml += "</root>";
+var items = [];
+var builder = new nkit.Xml2VarBuilder({"main": ["/item", "integer"]});
+builder.onItem("main", function (item) {
+    items.push(item);
+    if (item === 3 || item === 5)
+        throw new Error("stop");
+});
+[thrown_xml.slice(0, 100), thrown_xml.slice(100), ""].forEach(
+    function (chunk, index) {
+        try {
+            if (index === 2)
+                builder.end();
+            else
+                builder.feed(chunk);
+            if (index !== 2) {
+                console.error("Error #9.15");
+                process.exit(1);
+            }
+        } catch (e) {
+            if (e.message !== "stop") {
+                console.error("Error #9.16");
+                process.exit(1);
+            }
+        }
+    });
+check_result(items, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9], "9.17");
+
+// items of big chunk are passed by portions of default "high_water_mark"
+// items, while the rest of chunk is not parsed yet
+var suspended_calls = 0;
+var builder = new nkit.Xml2VarBuilder({"main": ["/item", "integer"]});
+builder.onItem("main", function (item) {
+    if (builder.isSuspended())
+        suspended_calls++;
+});
+builder.feed(thrown_xml.replace(/<item>9<\/item>/,
+    new Array(1000).join("<item>9</item>")));
+builder.end();
+if (suspended_calls < 900) {
+    console.error("Error #9.18");
+    process.exit(1);
+}
+
+// builder.get() and splice(0) between chunks: items of the next chunks are
+// appended to the rest of list
+var spliced_xml = "<root>";
+for (var i = 0; i < 10; i++)
+    spliced_xml += "<offer><id>" + i + "</id>" +
+        "<tags><tag>a" + i + "</tag><tag>b</tag></tags></offer>";
+spliced_xml += "</root>";
+var spliced_mappings = {"main": ["/offer", {"/id": "integer",
+                                            "/tags": ["/tag", "string"]}]};
+var builder = new nkit.Xml2VarBuilder(spliced_mappings);
+builder.feed(spliced_xml);
+var spliced_etalon = builder.end()["main"];
+
+var split = spliced_xml.indexOf("<offer><id>4") + 25;
+var builder = new nkit.Xml2VarBuilder(spliced_mappings);
+builder.feed(spliced_xml.slice(0, split));
+var list = builder.get("main");
+check_result(list, spliced_etalon.slice(0, 4), "9.12");
+list.splice(0);
+builder.feed(spliced_xml.slice(split));
+var rest = builder.end()["main"];
+check_result(rest, spliced_etalon.slice(4), "9.13");
+if (rest.length !== 6 || Object.keys(rest).length !== 6) {
+    console.error("Error #9.14");
+    process.exit(1);
+}
+
+// -----------------------------------------------------------------------------
+// pause() & resume(): backpressure with "high_water_mark" option
+// -----------------------------------------------------------------------------
+var item_count = 10;
+var paused_xml = "<root>";
+for (var i = 0; i < item_count; i++)
+    paused_xml += "<item>" + i + "</item>";
+paused_xml += "</root>";
+var paused_mappings = {"main": ["/item", "integer"]};
+
+// items are passed to callback by portions of 'high_water_mark' items
+var portions = [];
+var builder = new nkit.Xml2VarBuilder({"high_water_mark": 3}, paused_mappings);
+builder.onItem("main", function (item) {
+    if (!portions.length || portions[portions.length - 1].length === 3)
+        portions.push([]);
+    portions[portions.length - 1].push(item);
+});
+builder.feed(paused_xml);
+builder.end();
+check_result(portions, [[0, 1, 2], [3, 4, 5], [6, 7, 8], [9]], "9.5");
+
+// pause() in callback suspends parsing of current chunk until resume()
+items = [];
+var builder = new nkit.Xml2VarBuilder({"high_water_mark": 2}, paused_mappings);
+builder.onItem("main", function (item) {
+    items.push(item);
+    if (item === 3)
+        builder.pause();
+});
+builder.feed(paused_xml);
+check_result(items, [0, 1, 2, 3], "9.6");
+if (!builder.isPaused()) {
+    console.error("Error #9.7");
+    process.exit(1);
+}
+try {
+    builder.feed("<item>100</item>");
+    console.error("Error #9.8");
+    process.exit(1);
+} catch (e) {}
+builder.resume();
+check_result(items, [0, 1, 2, 3, 4, 5, 6, 7, 8, 9], "9.9");
+check_result(builder.end(), {"main": []}, "9.10");
+
+try {
+    new nkit.Xml2VarBuilder({"high_water_mark": 0}, paused_mappings);
+    console.error("Error #9.11");
+    process.exit(1);
+} catch (e) {}
+
+// pause() without "high_water_mark": no more items are passed and parsed
+// until resume()
+var pause_xml = "<root>";
+for (var i = 0; i < 100; i++)
+    pause_xml += "<item>" + i + "</item>";
+pause_xml += "</root>";
+items = [];
+var builder = new nkit.Xml2VarBuilder(paused_mappings);
+builder.onItem("main", function (item) {
+    items.push(item);
+    if (item === 20 || item === 50)
+        builder.pause();
+});
+builder.feed(pause_xml);
+if (items.length !== 21 || !builder.isPaused() || !builder.isSuspended()) {
+    console.error("Error #9.19");
+    process.exit(1);
+}
+builder.resume();
+if (items.length !== 51 || !builder.isPaused()) {
+    console.error("Error #9.20");
+    process.exit(1);
+}
+builder.resume();
+builder.end();
+if (items.length !== 100 || items[99] !== 99) {
+    console.error("Error #9.21");
+    process.exit(1);
+}
+
+// -----------------------------------------------------------------------------
+// feed(chunk, {sliceMs: N}): parsing of big chunk in time slices
+// -----------------------------------------------------------------------------
+var sliced_count = 10000;
+var sliced_xml = "<root>";
+for (var i = 0; i < sliced_count; i++)
+    sliced_xml += "<item><id>" + i + "</id></item>";
+sliced_xml += "</root>";
+var sliced_mappings = {"main": ["/item", {"/id": "integer"}]};
+
+var builder = new nkit.Xml2VarBuilder(sliced_mappings);
+builder.feed(sliced_xml, {"sliceMs": 0.001});
+if (!builder.isSuspended()) {
+    console.error("Error #12.1");
+    process.exit(1);
+}
+try {
+    builder.end();
+    console.error("Error #12.2");
+    process.exit(1);
+} catch (e) {}
+var slices = 1;
+while (builder.isSuspended()) {
+    builder.resume({"sliceMs": 0.001});
+    slices++;
+}
+var result = builder.end()["main"];
+if (slices < 3 || result.length !== sliced_count
+    || result[sliced_count - 1]["id"] !== sliced_count - 1) {
+    console.error("Error #12.3");
+    process.exit(1);
+}
+
+var builder = new nkit.AnyXml2VarBuilder({"explicit_array": false});
+builder.feed(sliced_xml, {"sliceMs": 0.001});
+if (!builder.isSuspended()) {
+    console.error("Error #12.4");
+    process.exit(1);
+}
+while (builder.isSuspended())
+    builder.resume({"sliceMs": 0.001});
+if (builder.end()["item"].length !== sliced_count) {
+    console.error("Error #12.5");
+    process.exit(1);
+}
+
+try {
+    new nkit.Xml2VarBuilder(sliced_mappings).feed("<root/>", {"sliceMs": 0});
+    console.error("Error #12.6");
+    process.exit(1);
+} catch (e) {}
+
+// too big time budget is no time budget
+var builder = new nkit.Xml2VarBuilder(sliced_mappings);
+builder.feed(sliced_xml, {"sliceMs": 1e300});
+if (builder.isSuspended() || builder.end()["main"].length !== sliced_count) {
+    console.error("Error #12.7");
+    process.exit(1);
+}
+
+// -----------------------------------------------------------------------------
+// compileMapping() & reset(): reusing mappings and builders
+// -----------------------------------------------------------------------------
+var compiled = nkit.compileMapping({"trim": false}, mappings);
+var builder1 = new nkit.Xml2VarBuilder(compiled);
+var builder2 = new nkit.Xml2VarBuilder(compiled);
+for (var i = 0; i < 3; i++) {
+    builder1.feed(xmlString.slice(0, 800)); // unfinished document
+    builder1.reset();
+    builder1.feed(xmlString);
+    builder2.feed(xmlString);
+    check_result(builder1.end(), sync_result, "11.1");
+    check_result(builder2.end(), sync_result, "11.2");
+    builder1.reset();
+    builder2.reset();
+}
+
+try {
+    nkit.compileMapping({"main": ["/person"]});
+    console.error("Error #11.3");
+    process.exit(1);
+} catch (e) {}
+
+var builder = new nkit.AnyXml2VarBuilder({"attrkey": "$", "trim": true});
+builder.feed(xmlString.slice(0, 800));
+builder.reset();
+builder.feed("<root><a>1</a></root>");
+check_result(builder.end(), {"a": ["1"]}, "11.4");
+
+// elements, which are open between chunks (and between internal
+// suspensions of parser), keep their values
+var deep_xml = '<root a="1">';
+for (var i = 0; i < 3000; i++)
+    deep_xml += '<group n="' + i + '"><item>' + i + '</item><item>x&amp;y</item>'
+        + '<sub><v>' + i + '</v></sub></group>';
+deep_xml += '<tail>end</tail></root>';
+var whole_builder = new nkit.AnyXml2VarBuilder({"attrkey": "$"});
+whole_builder.feed(deep_xml);
+var deep_result = whole_builder.end();
+var chunked_builder = new nkit.AnyXml2VarBuilder({"attrkey": "$"});
+for (var pos = 0; pos < deep_xml.length; pos += 777)
+    chunked_builder.feed(deep_xml.slice(pos, pos + 777));
+check_result(chunked_builder.end(), deep_result, "11.5");
+if (deep_result.group.length !== 3000 || deep_result.group[2999].sub[0].v[0]
+        !== "2999" || deep_result.tail[0] !== "end") {
+    console.error("Error #11.6");
+    process.exit(1);
+}
+
+// onItem(): elements of "emit_depth" are passed to callback and are not
+// kept in result
+var groups = [];
+var streaming_builder = new nkit.AnyXml2VarBuilder({"attrkey": "$"});
+streaming_builder.onItem("group", function (item, name) {
+    if (name !== "group") {
+        console.error("Error #11.7");
+        process.exit(1);
+    }
+    groups.push(item);
+});
+for (var pos = 0; pos < deep_xml.length; pos += 777)
+    streaming_builder.feed(deep_xml.slice(pos, pos + 777));
+var streamed_result = streaming_builder.end();
+check_result(groups, deep_result.group, "11.8");
+check_result(streamed_result, {"$": {"a": "1"}, "tail": ["end"]}, "11.9");
+
+var items = [];
+var streaming_builder = new nkit.AnyXml2VarBuilder({"emit_depth": 2});
+streaming_builder.onItem(function (item, name) {
+    items.push(name);
+});
+streaming_builder.feed(deep_xml);
+if (items.length !== 9000 || items[2] !== "sub"
+        || streaming_builder.end().group.length !== 3000) {
+    console.error("Error #11.10");
+    process.exit(1);
+}
+
+try {
+    new nkit.AnyXml2VarBuilder({"emit_depth": 0});
+    console.error("Error #11.11");
+    process.exit(1);
+} catch (e) {}
+
+// -----------------------------------------------------------------------------
+// "native" option: data is built natively and converted by get() and end()
+// -----------------------------------------------------------------------------
+var builder = new nkit.Xml2VarBuilder({"native": true}, mappings);
+builder.feed(xmlString.slice(0, 800));
+builder.feed(xmlString.slice(800));
+check_result(builder.get("phones"), sync_result["phones"], "13.1");
+check_result(builder.end(), sync_result, "13.2");
+
+var items = [];
+var builder = new nkit.Xml2VarBuilder({"native": true}, mappings);
+builder.onItem("main", function (item) {
+    items.push(item);
+});
+builder.feed(xmlString);
+check_result(items, sync_result["main"], "13.3");
+check_result(builder.end()["main"], [], "13.4");
+
+var native_builder = new nkit.AnyXml2VarBuilder({"attrkey": "$",
+    "native": true});
+for (var pos = 0; pos < deep_xml.length; pos += 777)
+    native_builder.feed(deep_xml.slice(pos, pos + 777));
+if (native_builder.get().group.length !== 3000) {
+    console.error("Error #13.5");
+    process.exit(1);
+}
+check_result(native_builder.end(), deep_result, "13.6");
+if (native_builder.root_name() !== "root") {
+    console.error("Error #13.7");
+    process.exit(1);
+}
+
+var groups = [];
+var native_builder = new nkit.AnyXml2VarBuilder({"attrkey": "$",
+    "native": true});
+native_builder.onItem("group", function (item) {
+    groups.push(item);
+});
+native_builder.feed(deep_xml, {"sliceMs": 0.001});
+while (native_builder.isSuspended())
+    native_builder.resume();
+check_result(groups, deep_result.group, "13.8");
+check_result(native_builder.end(), {"$": {"a": "1"}, "tail": ["end"]},
+    "13.9");
+
+// element with the same name as "textkey" or "attrkey": keys from data and
+// keys from options are the same properties
+var keys_xml = '<root><a x="1">t<tx>c</tx><tx>d</tx><at>e</at></a>' +
+    '<b><at y="2"/><tx>f</tx></b></root>';
+var builder = new nkit.AnyXml2VarBuilder({"attrkey": "at", "textkey": "tx"});
+builder.feed(keys_xml);
+var native_builder = new nkit.AnyXml2VarBuilder({"attrkey": "at",
+    "textkey": "tx", "native": true});
+native_builder.feed(keys_xml);
+check_result(builder.end(), native_builder.end(), "13.10");
+
+// get() returns the same list as without "native" option: new items are
+// appended to it, and splice(0) releases converted items
+var builder = new nkit.Xml2VarBuilder({"native": true}, spliced_mappings);
+builder.feed(spliced_xml.slice(0, split));
+var list = builder.get("main");
+check_result(list, spliced_etalon.slice(0, 4), "13.11");
+list.splice(0);
+builder.feed(spliced_xml.slice(split));
+if (builder.get("main") !== list) {
+    console.error("Error #13.12");
+    process.exit(1);
+}
+check_result(builder.end()["main"], spliced_etalon.slice(4), "13.13");
+
+// integers, which don't fit into 32 bits, are truncated without "int64"
+// option, as in JavaScript values, built during parsing
+var int64_xml = "<root><item>4294967297</item><item>-5</item></root>";
+[false, true].forEach(function (int64) {
+    var options = {"int64": int64};
+    var builder = new nkit.Xml2VarBuilder(options, paused_mappings);
+    builder.feed(int64_xml);
+    options["native"] = true;
+    var native_builder = new nkit.Xml2VarBuilder(options, paused_mappings);
+    native_builder.feed(int64_xml);
+    check_result(native_builder.end(), builder.end(), "13.14");
+});
+
+// AnyXml2VarBuilder keeps values of elements in local handles and persists
+// open elements after each chunk, which may get more children in the next
+// chunks: result must not depend on chunk bounds and must be the same as
+// result of native builder
+var local_xmls = [
+    // repeated children, also around and inside element with other ones
+    "<root><a>1</a><a>2</a><b><c>x</c><c>y</c><c>z</c></b><a>3</a>" +
+        "<d/><d/><b><c>w</c></b></root>",
+    // values of "attrkey" and "textkey" are set before children with the
+    // same names
+    '<root><e at="q" x="1">t<tx>c</tx><tx>d</tx><at>f</at><at>g</at>u</e>' +
+        '<e x="2"><at y="3"/><tx>h</tx></e><e>v</e></root>'
+];
+local_xmls.forEach(function (xml) {
+    [true, false].forEach(function (explicit_array) {
+        var options = {"attrkey": "at", "textkey": "tx",
+                       "explicit_array": explicit_array, "native": true};
+        var native_builder = new nkit.AnyXml2VarBuilder(options);
+        native_builder.feed(xml);
+        var etalon = native_builder.end();
+        delete options["native"];
+        [1, 2, 3, 5, 8, 13, xml.length].forEach(function (chunk_size) {
+            var builder = new nkit.AnyXml2VarBuilder(options);
+            for (var pos = 0; pos < xml.length; pos += chunk_size)
+                builder.feed(xml.slice(pos, pos + chunk_size));
+            check_result(builder.end(), etalon, "13.15");
+        });
+    });
+});
+
+// -----------------------------------------------------------------------------
+// "namespaces" option: names are "{uri}local", mappings match them by
+// namespace or by local name; "strip" leaves local names only
+// -----------------------------------------------------------------------------
+var ns_xml = '<?xml version="1.0" encoding="utf-8"?>' +
+    '<s:Envelope xmlns:s="http://schemas.xmlsoap.org/soap/envelope/"' +
+    ' xmlns:a="urn:a"><s:Body>' +
+    '<a:item a:id="1"><a:name>x</a:name></a:item>' +
+    '<item id="2"><name xmlns="urn:b">y</name></item>' +
+    '</s:Body></s:Envelope>';
+var builder = new nkit.Xml2VarBuilder({"namespaces": true}, {"main": [
+    "/{http://schemas.xmlsoap.org/soap/envelope/}Body/{urn:a}item",
+    {"/@id": "string", "/name": "string"}]});
+builder.feed(ns_xml);
+check_result(builder.end()["main"], [{"id": "1", "name": "x"}], "14.1");
+
+var builder = new nkit.Xml2VarBuilder({"namespaces": true}, {"main": [
+    "/Body/item", {"/@id": "string", "/name": "string"}]});
+builder.feed(ns_xml);
+check_result(builder.end()["main"], [{"id": "1", "name": "x"},
+                                     {"id": "2", "name": "y"}], "14.2");
+
+var builder = new nkit.AnyXml2VarBuilder({"namespaces": true,
+    "attrkey": "$", "explicit_array": false});
+builder.feed(ns_xml);
+var any_result = builder.end();
+if (builder.root_name() !==
+        "{http://schemas.xmlsoap.org/soap/envelope/}Envelope") {
+    console.error("Error #14.3");
+    process.exit(1);
+}
+check_result(any_result["{http://schemas.xmlsoap.org/soap/envelope/}Body"]
+    ["{urn:a}item"], {"$": {"{urn:a}id": "1"}, "{urn:a}name": "x"}, "14.4");
+
+var builder = new nkit.AnyXml2VarBuilder({"namespaces": "strip",
+    "attrkey": "$", "explicit_array": false, "native": true});
+builder.feed(ns_xml);
+check_result(builder.end(), {"Body": {"item": [
+    {"$": {"id": "1"}, "name": "x"},
+    {"$": {"id": "2"}, "name": "y"}]}}, "14.5");
+if (builder.root_name() !== "Envelope") {
+    console.error("Error #14.6");
+    process.exit(1);
+}
+
+try {
+    new nkit.AnyXml2VarBuilder({"namespaces": "prefix"});
+    console.error("Error #14.7");
+    process.exit(1);
+} catch (e) {}
+
+try {
+    new nkit.Xml2VarBuilder({"namespaces": true}, {"main": ["/item", "string"]})
+        .parseParallelAsync(ns_xml, function () {});
+    console.error("Error #14.8");
+    process.exit(1);
+} catch (e) {}
 
 // -----------------------------------------------------------------------------
 // Testing paths with '*'
@@ -576,3 +1338,339 @@ process.exit(0);
 //
 //console.log("ok");
 //process.exit(0);
+
+// -----------------------------------------------------------------------------
+// Asynchronous tests: each test calls done() when it is finished
+// -----------------------------------------------------------------------------
+var async_tests = [];
+
+function run_async_tests() {
+    var test = async_tests.shift();
+    if (!test) {
+        console.log("ok");
+        process.exit(0);
+    }
+    test(run_async_tests);
+}
+
+// -----------------------------------------------------------------------------
+// feedAsync() & endAsync(): parsing in libuv thread pool
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder(mappings);
+    builder.feedAsync(xmlString, function (error) {
+        if (error) {
+            console.error(error.message);
+            console.error("Error #10.1");
+            process.exit(1);
+        }
+
+        try {
+            builder.feed(xmlString);
+            console.error("Error #10.2");
+            process.exit(1);
+        } catch (e) {}
+
+        builder.endAsync(function (error, result) {
+            check_result(result, sync_result, "10.3");
+            done();
+        });
+    });
+
+    // Parsing is in progress, so builder must reject any other calls
+    try {
+        builder.feedAsync(xmlString, function () {});
+        console.error("Error #10.4");
+        process.exit(1);
+    } catch (e) {}
+});
+
+async_tests.push(function (done) {
+    var any_options = {"attrkey": "$", "trim": true};
+    var builder = new nkit.AnyXml2VarBuilder(any_options);
+    builder.feed(xmlString);
+    var any_sync_result = builder.end();
+
+    var builder = new nkit.AnyXml2VarBuilder(any_options);
+    builder.feedAsync(xmlString.toString("utf8"), function (error) {
+        builder.endAsync(function (error, result) {
+            check_result(result, any_sync_result, "10.5");
+            if (builder.root_name() !== "any_name") {
+                console.error("Error #10.6");
+                process.exit(1);
+            }
+            done();
+        });
+    });
+});
+
+async_tests.push(function (done) {
+    if (typeof Promise === 'undefined')
+        return done();
+
+    var builder = new nkit.Xml2VarBuilder(mappings);
+    builder.feedAsync(xmlString.slice(0, 100))
+        .then(function () {
+            return builder.feedAsync(xmlString.slice(100));
+        })
+        .then(function () {
+            return builder.endAsync();
+        })
+        .then(function (result) {
+            check_result(result, sync_result, "10.7");
+            var builder = new nkit.Xml2VarBuilder(mappings);
+            return builder.feedAsync("<wrong>xml</right>");
+        })
+        .then(function () {
+            console.error("Error #10.8");
+            process.exit(1);
+        }, function (error) {
+            done();
+        });
+});
+
+// onItem() with feedAsync()
+async_tests.push(function (done) {
+    var items = [];
+    var builder = new nkit.Xml2VarBuilder(mappings);
+    builder.onItem("main", function (item) {
+        items.push(item);
+    });
+    builder.feedAsync(xmlString.slice(0, 800), function (error) {
+        if (items.length !== 1) {
+            console.error("Error #10.9");
+            process.exit(1);
+        }
+        builder.feedAsync(xmlString.slice(800), function (error) {
+            builder.endAsync(function (error, result) {
+                check_result(items, sync_result["main"], "10.10");
+                check_result(result["main"], [], "10.11");
+                done();
+            });
+        });
+    });
+});
+
+// AnyXml2VarBuilder.onItem() with feedAsync()
+async_tests.push(function (done) {
+    var groups = [];
+    var builder = new nkit.AnyXml2VarBuilder({"attrkey": "$"});
+    builder.onItem("group", function (item) {
+        groups.push(item);
+    });
+    builder.feedAsync(deep_xml, function (error) {
+        builder.endAsync(function (error, result) {
+            check_result(groups, deep_result.group, "10.21");
+            check_result(result, {"$": {"a": "1"}, "tail": ["end"]}, "10.22");
+            done();
+        });
+    });
+});
+
+// reset() between asynchronous documents
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder(compiled);
+    builder.feedAsync(xmlString.slice(0, 800), function (error) {
+        builder.reset();
+        builder.feedAsync(xmlString, function (error) {
+            builder.endAsync(function (error, result) {
+                check_result(result, sync_result, "10.12");
+                done();
+            });
+        });
+    });
+});
+
+// reset() after parsing in the main thread: suspend interval of feed()
+// must not stop feedAsync() in the thread pool
+async_tests.push(function (done) {
+    var builder = new nkit.AnyXml2VarBuilder({"attrkey": "$",
+        "native": true});
+    builder.feed(deep_xml);
+    builder.end();
+    builder.reset();
+    builder.feedAsync(deep_xml, function (error) {
+        builder.endAsync(function (error, result) {
+            if (error) {
+                console.error("Error #10.23");
+                process.exit(1);
+            }
+            check_result(result, deep_result, "10.24");
+            done();
+        });
+    });
+});
+
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder({"native": true}, sliced_mappings);
+    builder.feed(sliced_xml, {"sliceMs": 0.001}, function (error) {
+        builder.reset();
+        builder.feedAsync(sliced_xml, function (error) {
+            builder.endAsync(function (error, result) {
+                if (error || result["main"].length !== sliced_count) {
+                    console.error("Error #10.25");
+                    process.exit(1);
+                }
+                done();
+            });
+        });
+    });
+});
+
+// pause() can't be called during feedAsync()
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder(paused_mappings);
+    builder.feedAsync(paused_xml, function (error) {
+        builder.endAsync(function (error, result) {
+            done();
+        });
+    });
+    try {
+        builder.pause();
+        console.error("Error #10.32");
+        process.exit(1);
+    } catch (e) {}
+});
+
+// "columnar" option with feedAsync()
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder({"columnar": true},
+        columnar_mappings);
+    builder.feedAsync(columnar_xml.join(""), function (error) {
+        builder.endAsync(function (error, result) {
+            check_columnar_result(result, "10.13");
+            done();
+        });
+    });
+});
+
+// -----------------------------------------------------------------------------
+// "limit" option with feedAsync()
+// -----------------------------------------------------------------------------
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder({"limit": {"main": 1}},
+        {"main": ["/item", "string"]});
+    builder.feedAsync("<root><item>1</item><item>2</item>",
+        function (error, finished) {
+            if (error || finished !== true) {
+                console.error("Error #10.14");
+                process.exit(1);
+            }
+            builder.endAsync(function (error, result) {
+                check_result(result, {"main": ["1"]}, "10.15");
+                done();
+            });
+        });
+});
+
+// -----------------------------------------------------------------------------
+// feed(chunk, {sliceMs: N}, callback): the rest of chunk is parsed in
+// setImmediate() callbacks
+// -----------------------------------------------------------------------------
+async_tests.push(function (done) {
+    var builder = new nkit.Xml2VarBuilder(sliced_mappings);
+    var event_loop_ticks = 0;
+    function tick() {
+        event_loop_ticks++;
+        if (builder.isSuspended())
+            setImmediate(tick);
+    }
+    var result = builder.feed(sliced_xml, {"sliceMs": 0.001}, function (error) {
+        var result = builder.end()["main"];
+        if (error || event_loop_ticks < 2 || result.length !== sliced_count) {
+            console.error("Error #10.16");
+            process.exit(1);
+        }
+        done();
+    });
+    setImmediate(tick);
+    if (result !== undefined) {
+        console.error("Error #10.17");
+        process.exit(1);
+    }
+});
+
+// -----------------------------------------------------------------------------
+// parseParallelAsync(): records are parsed by several threads
+// -----------------------------------------------------------------------------
+async_tests.push(function (done) {
+    var xml = '<?xml version="1.0" encoding="utf-8"?>\n<commerce>';
+    for (var i = 0; i < 20000; i++)
+        xml += "<offer><id>" + i + "</id><note>Привет</note></offer>";
+    xml += "</commerce>";
+    var mappings = {"main": ["/offer", {"/id": "integer", "/note": "string"}],
+                    "ids": ["/offer/id", "integer"]};
+    var builder = new nkit.Xml2VarBuilder(mappings);
+    builder.feed(xml);
+    var sync_result = builder.end();
+
+    try {
+        new nkit.Xml2VarBuilder({"main": ["/offer", "string"],
+                                 "header": {"/title": "string"}})
+            .parseParallelAsync(xml, function () {});
+        console.error("Error #10.18");
+        process.exit(1);
+    } catch (e) {}
+
+    try {
+        new nkit.Xml2VarBuilder({"limit": {"main": 10}}, mappings)
+            .parseParallelAsync(xml, function () {});
+        console.error("Error #10.28");
+        process.exit(1);
+    } catch (e) {}
+
+    new nkit.Xml2VarBuilder(mappings).parseParallelAsync(new Buffer(xml),
+        {"threads": 4}, function (error, result) {
+            if (error) {
+                console.error(error.message);
+                console.error("Error #10.19");
+                process.exit(1);
+            }
+            check_result(result, sync_result, "10.20");
+            // too big number of threads is limited
+            new nkit.Xml2VarBuilder(mappings).parseParallelAsync(xml,
+                {"threads": 1e300}, function (error, result) {
+                    if (error) {
+                        console.error("Error #10.26");
+                        process.exit(1);
+                    }
+                    check_result(result, sync_result, "10.27");
+                    done();
+                });
+        });
+});
+
+// record start tags in nested elements, comments and CDATA sections:
+// document is parsed by one thread
+async_tests.push(function (done) {
+    var xml = "<commerce>";
+    for (var i = 0; i < 20000; i++)
+        xml += "<offer><id>" + i + "</id><!-- <offer> -->" +
+            "<![CDATA[<offer>]]><sub><offer>" + i + "</offer></sub></offer>";
+    xml += "</commerce>";
+    var mappings = {"main": ["/offer", {"/id": "integer"}],
+                    "subs": ["/offer/sub/offer", "integer"]};
+    var builder = new nkit.Xml2VarBuilder(mappings);
+    builder.feed(xml);
+    var sync_result = builder.end();
+
+    new nkit.Xml2VarBuilder(mappings).parseParallelAsync(xml,
+        function (error, result) {
+            if (error) {
+                console.error("Error #10.29");
+                process.exit(1);
+            }
+            check_result(result, sync_result, "10.30");
+            new nkit.Xml2VarBuilder(mappings).parseParallelAsync(
+                xml + "<wrong/>", function (error, result) {
+                    // position is counted from beginning of document
+                    if (!error || error.message.indexOf(
+                            "column:" + xml.length + ")") === -1) {
+                        console.error("Error #10.31");
+                        process.exit(1);
+                    }
+                    done();
+                });
+        });
+});
+
+run_async_tests();